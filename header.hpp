@@ -11,6 +11,28 @@ int main (int argc, char *argv[]);
 
 void testBitsets ();
 
+void testWideBitsets ();
+
+void testCompressedBitsets ();
+
+void testFixedBitsets ();
+
+void testConcurrentBitsets ();
+
+void testBitsetViews ();
+
+void testSerialization ();
+
+void testBitsetStreams ();
+
+void testAllocators ();
+
+void testSharedBitsets ();
+
+void testTrimPolicies ();
+
+void testHashingAndOrdering ();
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 #endif
@@ -1,447 +1,3840 @@
 #include "bitset.hpp"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BITSET_LITTLEENDIAN
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITSET_X86KERNELS
+#include <immintrin.h>
+#endif
 
 LIB_DEPENDENCIES
 
 namespace bitset {
 
 using core::getLowestSetBit;
-using core::string;
 using std::move;
+using std::swap;
+using std::unique_ptr;
 using std::min;
+using std::max;
+using std::memcmp;
+using std::memcpy;
+using std::vector;
+using std::upper_bound;
+using std::fill;
+using std::copy;
+using std::lower_bound;
+using std::binary_search;
+using std::set_union;
+using std::set_intersection;
+using std::set_difference;
+using std::back_inserter;
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 DC();
 
-constexpr size_t Bitset::bits;
-constexpr Bitset::word Bitset::one;
-constexpr size_t Bitset::nonIndex;
+namespace {
 
-Bitset::Bitset () {
+typedef size_t (*Kernel) (const void *i0, const void *i1, size_t size, void *r_o);
+typedef size_t (*ScanKernel) (const void *b, size_t size);
+typedef size_t (*CountKernel) (const void *b, size_t size, size_t &r_count);
+typedef size_t (*DecodeKernel) (const void *b, size_t size, iu32 *&r_o);
+
+template<typename _i> iu getSetBitCount (_i v) noexcept {
+#ifdef __GNUC__
+  return sizeof(v) <= sizeof(unsigned int) ? __builtin_popcount(v) : __builtin_popcountll(v);
+#else
+  iu count = 0;
+  for (; v != 0; v &= v - 1) {
+    ++count;
+  }
+  return count;
+#endif
 }
 
-Bitset::Bitset (size_t width) : b((width + (bits - 1)) / bits) {
-  ensureWidth(width);
+#ifdef __SIZEOF_INT128__
+iu getSetBitCount (iu128 v) noexcept {
+  return getSetBitCount(static_cast<iu64>(v)) + getSetBitCount(static_cast<iu64>(v >> 64));
 }
+#endif
 
-Bitset::Bitset (size_t size, bool) : b(size) {
-  b.append_any(size);
+enum class KernelOp {
+  OR, AND, AND_NOT, XOR
+};
+
+size_t scalarKernel (const void *i0, const void *i1, size_t size, void *r_o) noexcept {
+  return 0;
 }
 
-void Bitset::ensureWidth (size_t width) {
-  if (width != 0) {
-    ensureWidthForWord((width - 1) / bits);
+size_t scalarScanKernel (const void *b, size_t size) noexcept {
+  return 0;
+}
+
+size_t scalarCountKernel (const void *b, size_t size, size_t &r_count) noexcept {
+  return 0;
+}
+
+size_t scalarDecodeKernel (const void *b, size_t size, iu32 *&r_o) noexcept {
+  return 0;
+}
+
+#ifdef BITSET_X86KERNELS
+template<KernelOp _op> __attribute__((target("sse2"))) size_t sse2Kernel (const void *i0, const void *i1, size_t size, void *r_o) noexcept {
+  const char *p0 = static_cast<const char *>(i0);
+  const char *p1 = static_cast<const char *>(i1);
+  char *o = static_cast<char *>(r_o);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m128i) - 1);
+
+  for (size_t i = 0; i != end; i += sizeof(__m128i)) {
+    __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p0 + i));
+    __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p1 + i));
+    __m128i v = _op == KernelOp::OR ? _mm_or_si128(v0, v1) : _op == KernelOp::AND ? _mm_and_si128(v0, v1) : _op == KernelOp::AND_NOT ? _mm_andnot_si128(v1, v0) : _mm_xor_si128(v0, v1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(o + i), v);
   }
+  return end;
 }
 
-void Bitset::ensureWidthForWord (size_t wordI) {
-  size_t bSize = b.size();
-  if (wordI >= bSize) {
-    b.append(wordI + 1 - bSize, 0);
+template<KernelOp _op> __attribute__((target("avx2"))) size_t avx2Kernel (const void *i0, const void *i1, size_t size, void *r_o) noexcept {
+  const char *p0 = static_cast<const char *>(i0);
+  const char *p1 = static_cast<const char *>(i1);
+  char *o = static_cast<char *>(r_o);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m256i) - 1);
+
+  for (size_t i = 0; i != end; i += sizeof(__m256i)) {
+    __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p0 + i));
+    __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p1 + i));
+    __m256i v = _op == KernelOp::OR ? _mm256_or_si256(v0, v1) : _op == KernelOp::AND ? _mm256_and_si256(v0, v1) : _op == KernelOp::AND_NOT ? _mm256_andnot_si256(v1, v0) : _mm256_xor_si256(v0, v1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(o + i), v);
   }
+  return end;
 }
 
-bool Bitset::wordIsWithinWidth (size_t wordI) const noexcept {
-  return wordI < b.size();
+template<KernelOp _op> __attribute__((target("avx512f"))) size_t avx512Kernel (const void *i0, const void *i1, size_t size, void *r_o) noexcept {
+  const char *p0 = static_cast<const char *>(i0);
+  const char *p1 = static_cast<const char *>(i1);
+  char *o = static_cast<char *>(r_o);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m512i) - 1);
+
+  for (size_t i = 0; i != end; i += sizeof(__m512i)) {
+    __m512i v0 = _mm512_loadu_si512(p0 + i);
+    __m512i v1 = _mm512_loadu_si512(p1 + i);
+    __m512i v = _op == KernelOp::OR ? _mm512_or_si512(v0, v1) : _op == KernelOp::AND ? _mm512_and_si512(v0, v1) : _op == KernelOp::AND_NOT ? _mm512_andnot_si512(v1, v0) : _mm512_xor_si512(v0, v1);
+    _mm512_storeu_si512(o + i, v);
+  }
+  return end;
 }
 
-void Bitset::setExistingBit (size_t i) noexcept {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
+template<bool _ones> __attribute__((target("sse2"))) size_t sse2ScanKernel (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m128i) - 1);
+  __m128i sought = _ones ? _mm_set1_epi32(-1) : _mm_setzero_si128();
 
-  DPRE(wordIsWithinWidth(wordI));
-  b[wordI] |= one << bitI;
+  size_t i = 0;
+  for (; i != end; i += sizeof(__m128i)) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, sought)) != 0xFFFF) {
+      break;
+    }
+  }
+  return i;
 }
 
-void Bitset::setBit (size_t i) {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
-
-  ensureWidthForWord(wordI);
-  b[wordI] |= one << bitI;
+template<bool _ones> __attribute__((target("avx2"))) size_t avx2ScanKernel (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m256i) * 2 - 1);
+  __m256i allOnes = _mm256_set1_epi32(-1);
+
+  // Test two vectors (512 bits) per step, falling back to a single vector for the last step.
+  size_t i = 0;
+  for (; i != end; i += sizeof(__m256i) * 2) {
+    __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + sizeof(__m256i)));
+    if (_ones ? !_mm256_testc_si256(_mm256_and_si256(v0, v1), allOnes) : !_mm256_testz_si256(_mm256_or_si256(v0, v1), allOnes)) {
+      break;
+    }
+  }
+  end = size & ~static_cast<size_t>(sizeof(__m256i) - 1);
+  for (; i != end; i += sizeof(__m256i)) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    if (_ones ? !_mm256_testc_si256(v, allOnes) : !_mm256_testz_si256(v, allOnes)) {
+      break;
+    }
+  }
+  return i;
 }
 
-void Bitset::clearExistingBit (size_t i) noexcept {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
+template<bool _ones> __attribute__((target("avx512f"))) size_t avx512ScanKernel (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m512i) - 1);
+  __m512i sought = _ones ? _mm512_set1_epi32(-1) : _mm512_setzero_si512();
 
-  DPRE(wordIsWithinWidth(wordI));
-  b[wordI] &= ~(one << bitI);
+  size_t i = 0;
+  for (; i != end; i += sizeof(__m512i)) {
+    __m512i v = _mm512_loadu_si512(p + i);
+    if (_mm512_cmpneq_epi64_mask(v, sought) != 0) {
+      break;
+    }
+  }
+  return i;
 }
 
-void Bitset::clearBit (size_t i) {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
+template<bool _ones> __attribute__((target("sse2"))) size_t sse2ScanBackKernel (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  __m128i sought = _ones ? _mm_set1_epi32(-1) : _mm_setzero_si128();
 
-  if (wordIsWithinWidth(wordI)) {
-    b[wordI] &= ~(one << bitI);
+  size_t i = size;
+  for (; i >= sizeof(__m128i); i -= sizeof(__m128i)) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i - sizeof(__m128i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, sought)) != 0xFFFF) {
+      break;
+    }
   }
+  return size - i;
 }
 
-bool Bitset::getExistingBit (size_t i) const noexcept {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
+template<bool _ones> __attribute__((target("avx2"))) size_t avx2ScanBackKernel (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  __m256i allOnes = _mm256_set1_epi32(-1);
 
-  DPRE(wordIsWithinWidth(wordI));
-  return (b[wordI] >> bitI) & 0b1;
+  // Test two vectors (512 bits) per step, falling back to a single vector for the last step.
+  size_t i = size;
+  for (; i >= sizeof(__m256i) * 2; i -= sizeof(__m256i) * 2) {
+    __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i - sizeof(__m256i) * 2));
+    __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i - sizeof(__m256i)));
+    if (_ones ? !_mm256_testc_si256(_mm256_and_si256(v0, v1), allOnes) : !_mm256_testz_si256(_mm256_or_si256(v0, v1), allOnes)) {
+      break;
+    }
+  }
+  for (; i >= sizeof(__m256i); i -= sizeof(__m256i)) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i - sizeof(__m256i)));
+    if (_ones ? !_mm256_testc_si256(v, allOnes) : !_mm256_testz_si256(v, allOnes)) {
+      break;
+    }
+  }
+  return size - i;
 }
 
-bool Bitset::getBit (size_t i) const noexcept {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
+template<bool _ones> __attribute__((target("avx512f"))) size_t avx512ScanBackKernel (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  __m512i sought = _ones ? _mm512_set1_epi32(-1) : _mm512_setzero_si512();
 
-  return wordIsWithinWidth(wordI) ? (b[wordI] >> bitI) & 0b1 : 0;
+  size_t i = size;
+  for (; i >= sizeof(__m512i); i -= sizeof(__m512i)) {
+    __m512i v = _mm512_loadu_si512(p + i - sizeof(__m512i));
+    if (_mm512_cmpneq_epi64_mask(v, sought) != 0) {
+      break;
+    }
+  }
+  return size - i;
 }
 
-template<typename _OutOfRangeResult, typename _ReadOp> size_t Bitset::getNextBit (size_t i, const _OutOfRangeResult &outOfRangeResult, const _ReadOp &readOp) const noexcept {
-  size_t wordI = i / bits;
-  size_t bitI = i % bits;
+__attribute__((target("popcnt"))) size_t popcntCountKernel (const void *b, size_t size, size_t &r_count) noexcept {
+  const char *p = static_cast<const char *>(b);
+  size_t end = size & ~static_cast<size_t>(sizeof(iu64) - 1);
 
-  if (!wordIsWithinWidth(wordI)) {
-    return outOfRangeResult(i);
+  size_t count = 0;
+  for (size_t i = 0; i != end; i += sizeof(iu64)) {
+    iu64 v;
+    memcpy(&v, p + i, sizeof(iu64));
+    count += static_cast<size_t>(__builtin_popcountll(v));
   }
+  r_count += count;
+  return end;
+}
 
-  // Check for a bit in the remainder of the word.
-  word remainder = readOp(b[wordI]) >> bitI;
-  iu lowI = getLowestSetBit(remainder);
-  if (lowI < bits) {
-    return i + lowI;
+__attribute__((target("avx512f,avx512vpopcntdq"))) size_t avx512CountKernel (const void *b, size_t size, size_t &r_count) noexcept {
+  const char *p = static_cast<const char *>(b);
+  size_t end = size & ~static_cast<size_t>(sizeof(__m512i) - 1);
+
+  __m512i counts = _mm512_setzero_si512();
+  for (size_t i = 0; i != end; i += sizeof(__m512i)) {
+    counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(_mm512_loadu_si512(p + i)));
   }
+  r_count += static_cast<size_t>(_mm512_reduce_add_epi64(counts));
+  return end;
+}
 
-  // Look at the following words and find the first non-zero one.
-  DA(remainder == 0);
-  size_t begin = wordI + 1;
-  size_t end = b.size();
-  for (; begin != end; ++begin) {
-    remainder = readOp(b[begin]);
-    if (remainder != 0) {
-      // Get the bit out of it (since there is one).
-      lowI = getLowestSetBit(remainder);
-      DA(lowI < bits);
-      return begin * bits + lowI;
+__attribute__((target("avx512f"))) size_t avx512DecodeKernel (const void *b, size_t size, iu32 *&r_o) noexcept {
+  const char *p = static_cast<const char *>(b);
+  size_t end = size & ~static_cast<size_t>(sizeof(iu64) - 1);
+  iu32 *o = r_o;
+
+  // Compress the indices of each 16 bits down to just those of the set bits.
+  __m512i indices = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  for (size_t i = 0; i != end; i += sizeof(iu64)) {
+    iu64 v;
+    memcpy(&v, p + i, sizeof(iu64));
+    if (v == 0) {
+      indices = _mm512_add_epi32(indices, _mm512_set1_epi32(64));
+      continue;
+    }
+    for (iu j = 0; j != 4; ++j) {
+      __mmask16 mask = static_cast<__mmask16>(v >> (j * 16));
+      _mm512_mask_compressstoreu_epi32(o, mask, indices);
+      o += __builtin_popcount(mask);
+      indices = _mm512_add_epi32(indices, _mm512_set1_epi32(16));
     }
   }
-
-  DA(end == begin);
-  return outOfRangeResult(end * bits);
+  r_o = o;
+  return end;
 }
-
-size_t Bitset::getNextSetBit (size_t i) const noexcept {
-  return this->getNextBit(i, [] (size_t i) -> size_t {
-    return nonIndex;
-  }, [] (word w) -> word {
-    return w;
-  });
+#endif
+
+struct Kernels {
+  Kernel orKernel;
+  Kernel andKernel;
+  Kernel andNotKernel;
+  Kernel xorKernel;
+  ScanKernel zeroScanKernel;
+  ScanKernel onesScanKernel;
+  ScanKernel zeroScanBackKernel;
+  ScanKernel onesScanBackKernel;
+  CountKernel countKernel;
+  DecodeKernel decodeKernel;
+};
+
+Kernels selectKernels () noexcept {
+  Kernels kernels = {
+    scalarKernel, scalarKernel, scalarKernel, scalarKernel, scalarScanKernel, scalarScanKernel, scalarScanKernel,
+    scalarScanKernel, scalarCountKernel, scalarDecodeKernel
+  };
+#ifdef BITSET_X86KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels.orKernel = avx512Kernel<KernelOp::OR>;
+    kernels.andKernel = avx512Kernel<KernelOp::AND>;
+    kernels.andNotKernel = avx512Kernel<KernelOp::AND_NOT>;
+    kernels.xorKernel = avx512Kernel<KernelOp::XOR>;
+    kernels.zeroScanKernel = avx512ScanKernel<false>;
+    kernels.onesScanKernel = avx512ScanKernel<true>;
+    kernels.zeroScanBackKernel = avx512ScanBackKernel<false>;
+    kernels.onesScanBackKernel = avx512ScanBackKernel<true>;
+    kernels.decodeKernel = avx512DecodeKernel;
+  } else if (__builtin_cpu_supports("avx2")) {
+    kernels.orKernel = avx2Kernel<KernelOp::OR>;
+    kernels.andKernel = avx2Kernel<KernelOp::AND>;
+    kernels.andNotKernel = avx2Kernel<KernelOp::AND_NOT>;
+    kernels.xorKernel = avx2Kernel<KernelOp::XOR>;
+    kernels.zeroScanKernel = avx2ScanKernel<false>;
+    kernels.onesScanKernel = avx2ScanKernel<true>;
+    kernels.zeroScanBackKernel = avx2ScanBackKernel<false>;
+    kernels.onesScanBackKernel = avx2ScanBackKernel<true>;
+  } else if (__builtin_cpu_supports("sse2")) {
+    kernels.orKernel = sse2Kernel<KernelOp::OR>;
+    kernels.andKernel = sse2Kernel<KernelOp::AND>;
+    kernels.andNotKernel = sse2Kernel<KernelOp::AND_NOT>;
+    kernels.xorKernel = sse2Kernel<KernelOp::XOR>;
+    kernels.zeroScanKernel = sse2ScanKernel<false>;
+    kernels.onesScanKernel = sse2ScanKernel<true>;
+    kernels.zeroScanBackKernel = sse2ScanBackKernel<false>;
+    kernels.onesScanBackKernel = sse2ScanBackKernel<true>;
+  }
+  if (__builtin_cpu_supports("avx512vpopcntdq")) {
+    kernels.countKernel = avx512CountKernel;
+  } else if (__builtin_cpu_supports("popcnt")) {
+    kernels.countKernel = popcntCountKernel;
+  }
+#endif
+  return kernels;
 }
 
-size_t Bitset::getNextClearBit (size_t i) const noexcept {
-  return this->getNextBit(i, [] (size_t i) -> size_t {
-    return i;
-  }, [] (word w) -> word {
-    return ~w;
-  });
+/**
+  Gets the kernels for the host CPU (chosen once, on first use, so that use during static initialisation elsewhere
+  is safe).
+*/
+const Kernels &getKernels () noexcept {
+  static const Kernels kernels = selectKernels();
+  return kernels;
 }
 
-void Bitset::clear () noexcept {
-  b.clear();
+constexpr iu64 hashSecrets[] = {0xA0761D6478BD642F, 0xE7037ED1A0B428DB, 0x8EBC6AF09C88C6E3, 0x589965CC75374CC3};
+
+/**
+  Multiplies a and b, folding the high half of the product into the low half.
+*/
+iu64 mixHash (iu64 a, iu64 b) noexcept {
+#ifdef __SIZEOF_INT128__
+  iu128 product = static_cast<iu128>(a) * b;
+  return static_cast<iu64>(product) ^ static_cast<iu64>(product >> 64);
+#else
+  iu64 aHi = a >> 32;
+  iu64 aLo = a & 0xFFFFFFFF;
+  iu64 bHi = b >> 32;
+  iu64 bLo = b & 0xFFFFFFFF;
+  iu64 mid0 = aHi * bLo;
+  iu64 mid1 = aLo * bHi;
+  iu64 lo = aLo * bLo;
+  iu64 carry = ((lo >> 32) + (mid0 & 0xFFFFFFFF) + (mid1 & 0xFFFFFFFF)) >> 32;
+  iu64 hi = aHi * bHi + (mid0 >> 32) + (mid1 >> 32) + carry;
+  return (lo + (mid0 << 32) + (mid1 << 32)) ^ hi;
+#endif
 }
 
-bool Bitset::empty () const noexcept {
-  for (const word &w : b) {
-    if (w != 0) {
-      return false;
-    }
-  }
-  return true;
+iu64 loadHashUnit (const char *p) noexcept {
+  iu64 u;
+  memcpy(&u, p, sizeof(iu64));
+  return u;
 }
 
-void Bitset::compact () {
-  for (size_t i = b.size() - 1; i != static_cast<size_t>(-1); --i) {
-    if (b[i] != 0) {
-      b.erase(i + 1);
-      break;
-    }
+/**
+  Hashes the given byte range (in the manner of wyhash), returning a non-zero value.
+*/
+size_t hashBytes (const void *b, size_t size) noexcept {
+  const char *p = static_cast<const char *>(b);
+  iu64 h0 = hashSecrets[0] ^ size;
+  iu64 h1 = hashSecrets[1];
+
+  size_t i = 0;
+  for (size_t end = size & ~static_cast<size_t>(31); i != end; i += 32) {
+    h0 = mixHash(loadHashUnit(p + i) ^ hashSecrets[2], loadHashUnit(p + i + 8) ^ h0);
+    h1 = mixHash(loadHashUnit(p + i + 16) ^ hashSecrets[3], loadHashUnit(p + i + 24) ^ h1);
+  }
+  // Take the rest sixteen bytes at a time, padding the last with zeros.
+  for (; i < size; i += 16) {
+    char tail[16] = {};
+    memcpy(tail, p + i, min(size - i, sizeof(tail)));
+    h0 = mixHash(loadHashUnit(tail) ^ hashSecrets[2], loadHashUnit(tail + 8) ^ h0);
   }
 
-  b.shrink_to_fit();
+  size_t h = static_cast<size_t>(mixHash(h0 ^ hashSecrets[3], h1 ^ hashSecrets[0]));
+  return h != 0 ? h : 1;
 }
 
-template<typename _MergeOp> void Bitset::op (
-  const string<word> &i0, const string<word> &i1, size_t iSize,
-  string<word> &r_o, _MergeOp mergeOp
-) {
-  DPRE(r_o.size() >= iSize, "r_o must have size at least that of the smaller of the inputs");
-
-  for (size_t i = 0; i != iSize; ++i) {
-    r_o[i] = mergeOp(i0[i], i1[i]);
-  }
 }
 
-template<typename _MergeOp, typename _RemainderOp> void Bitset::op (
-  const string<word> &i0, size_t i0Size, const string<word> &i1, size_t i1Size,
-  string<word> &r_o, _MergeOp mergeOp, _RemainderOp remainderOp
-) {
-  DPRE(i0Size >= i1Size);
-  DPRE(r_o.size() >= i0Size, "r_o must have size at least that of the bigger of the inputs");
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+thread_local WordAllocator *WordAllocator::current = nullptr;
 
-  op(i0, i1, i1Size, r_o, mergeOp);
-  for (size_t i = i1Size; i != i0Size; ++i) {
-    r_o[i] = remainderOp(i0[i]);
-  }
+WordAllocator::~WordAllocator () noexcept {
 }
 
-void Bitset::orOp (const string<word> &i0, size_t i0Size, const string<word> &i1, size_t i1Size, string<word> &r_o) {
-  DPRE(i0Size >= i1Size);
-  DPRE(r_o.size() == i0Size);
-  Bitset::op(i0, i0Size, i1, i1Size, r_o, [] (word v0, word v1) -> word {
-    return v0 | v1;
-  }, [] (word o) -> word {
-    return o;
-  });
+AllocatorScope::AllocatorScope (WordAllocator &allocator) noexcept : previous(WordAllocator::current) {
+  WordAllocator::current = &allocator;
 }
 
-void Bitset::andOp (const string<word> &i0, const string<word> &i1, size_t iSize, string<word> &r_o) {
-  DPRE(r_o.size() == iSize);
-  Bitset::op(i0, i1, iSize, r_o, [] (word v0, word v1) -> word {
-    return v0 & v1;
-  });
+AllocatorScope::~AllocatorScope () noexcept {
+  WordAllocator::current = previous;
 }
 
-void Bitset::andNotOp (const string<word> &i0, size_t i0Size, const string<word> &i1, size_t i1Size, string<word> &r_o) {
-  DPRE(i0Size >= i1Size);
-  DPRE(r_o.size() == i0Size);
-  Bitset::op(i0, i0Size, i1, i1Size, r_o, [] (word v0, word v1) -> word {
-    return v0 & ~v1;
-  }, [] (word o) -> word {
-    return o;
-  });
-}
+struct MonotonicArena::Block {
+  Block *next;
+};
 
-Bitset &Bitset::operator|= (Bitset &&r) {
-  *this = move(*this) | move(r);
-  return *this;
+namespace {
+
+constexpr size_t arenaAlignment = alignof(std::max_align_t);
+
+size_t alignUp (size_t size) noexcept {
+  return (size + arenaAlignment - 1) / arenaAlignment * arenaAlignment;
 }
 
-Bitset &Bitset::operator|= (const Bitset &r) {
-  *this = move(*this) | r;
-  return *this;
 }
 
-Bitset operator| (Bitset &&l, Bitset &&r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+MonotonicArena::MonotonicArena (size_t initialSize) noexcept : blocks(nullptr), next(nullptr), end(nullptr), nextBlockSize(max(initialSize, arenaAlignment)) {
+}
 
-  if (lSize < rSize) {
-    Bitset o(move(r));
+MonotonicArena::~MonotonicArena () noexcept {
+  release();
+}
 
-    Bitset::orOp(o.b, rSize, l.b, lSize, o.b);
+void *MonotonicArena::allocate (size_t size) {
+  size = alignUp(size);
+  if (size > static_cast<size_t>(end - next)) {
+    size_t blockSize = max(nextBlockSize, size);
+    char *block = static_cast<char *>(::operator new(alignUp(sizeof(Block)) + blockSize));
+    reinterpret_cast<Block *>(block)->next = blocks;
+    blocks = reinterpret_cast<Block *>(block);
+    next = block + alignUp(sizeof(Block));
+    end = next + blockSize;
+    nextBlockSize = blockSize * 2;
+  }
 
-    return o;
-  } else {
-    Bitset o(move(l));
+  void *p = next;
+  next += size;
+  return p;
+}
 
-    Bitset::orOp(o.b, lSize, r.b, rSize, o.b);
+void MonotonicArena::deallocate (void *p, size_t size) noexcept {
+}
 
-    return o;
+void MonotonicArena::release () noexcept {
+  while (blocks) {
+    Block *block = blocks;
+    blocks = block->next;
+    ::operator delete(block);
   }
+  next = nullptr;
+  end = nullptr;
 }
 
-Bitset operator| (Bitset &&l, const Bitset &r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+constexpr size_t PoolAllocator::minClassSize;
+constexpr size_t PoolAllocator::maxClassSize;
+constexpr size_t PoolAllocator::classCount;
 
-  if (l.b.capacity() < rSize) {
-    DA(lSize < rSize);
-    Bitset o(rSize, false);
+struct PoolAllocator::FreeBlock {
+  FreeBlock *next;
+};
 
-    Bitset::orOp(r.b, rSize, l.b, lSize, o.b);
+PoolAllocator::PoolAllocator () noexcept {
+  fill(freeLists, freeLists + classCount, nullptr);
+}
 
-    return o;
-  } else {
-    Bitset o(move(l));
-    const string<Bitset::word> *i0 = &o.b;
-    size_t i0Size = lSize;
-    const string<Bitset::word> *i1 = &r.b;
-    size_t i1Size = rSize;
-    if (lSize < rSize) {
-      i0 = &r.b;
-      i0Size = rSize;
-      i1 = &o.b;
-      i1Size = lSize;
-      o.b.append_any(rSize - lSize);
+PoolAllocator::~PoolAllocator () noexcept {
+  for (FreeBlock *&list : freeLists) {
+    while (list) {
+      FreeBlock *block = list;
+      list = block->next;
+      ::operator delete(block);
     }
-
-    Bitset::orOp(*i0, i0Size, *i1, i1Size, o.b);
-
-    return o;
   }
 }
 
-Bitset operator| (const Bitset &l, Bitset &&r) {
-  return move(r) | l;
+size_t PoolAllocator::getClass (size_t size) noexcept {
+  size_t classI = 0;
+  for (size_t classSize = minClassSize; classSize < size; classSize *= 2) {
+    ++classI;
+  }
+  return classI;
 }
 
-Bitset operator| (const Bitset &l, const Bitset &r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+void *PoolAllocator::allocate (size_t size) {
+  if (size > maxClassSize) {
+    return ::operator new(size);
+  }
 
-  const string<Bitset::word> *i0 = &l.b;
-  size_t i0Size = lSize;
-  const string<Bitset::word> *i1 = &r.b;
-  size_t i1Size = rSize;
-  if (lSize < rSize) {
-    i0 = &r.b;
-    i0Size = rSize;
-    i1 = &l.b;
-    i1Size = lSize;
+  size_t classI = getClass(size);
+  FreeBlock *&list = freeLists[classI];
+  if (list) {
+    FreeBlock *block = list;
+    list = block->next;
+    return block;
   }
-  Bitset o(i0Size, false);
+  return ::operator new(minClassSize << classI);
+}
 
-  Bitset::orOp(*i0, i0Size, *i1, i1Size, o.b);
+void PoolAllocator::deallocate (void *p, size_t size) noexcept {
+  if (size > maxClassSize) {
+    ::operator delete(p);
+    return;
+  }
 
-  return o;
+  FreeBlock *block = static_cast<FreeBlock *>(p);
+  FreeBlock *&list = freeLists[getClass(size)];
+  block->next = list;
+  list = block;
 }
 
-Bitset &Bitset::operator&= (Bitset &&r) {
-  *this = move(*this) & move(r);
-  return *this;
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+struct ThreadPool::Job {
+  const std::function<void (size_t chunkI)> *op;
+  size_t chunkCount;
+  std::atomic<size_t> nextChunkI;
+  /**
+    The number of worker threads that have joined the job and not yet finished with it.
+  */
+  size_t workerCount;
+};
+
+ThreadPool::ThreadPool (size_t threadCount) : job(nullptr), generation(0), stopping(false) {
+  for (size_t i = 1; i < threadCount; ++i) {
+    threads.emplace_back(&ThreadPool::work, this);
+  }
 }
 
-Bitset &Bitset::operator&= (const Bitset &r) {
-  *this = move(*this) & r;
-  return *this;
+ThreadPool::~ThreadPool () noexcept {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stopping = true;
+  }
+  workCondition.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
 }
 
-Bitset operator& (Bitset &&l, Bitset &&r) {
-  return move(l) & r;
+size_t ThreadPool::getThreadCount () const noexcept {
+  return threads.size() + 1;
 }
 
-Bitset operator& (Bitset &&l, const Bitset &r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
-
-  Bitset o(move(l));
-  size_t oSize;
-  if (lSize < rSize) {
-    oSize = lSize;
-  } else {
-    oSize = rSize;
-    o.b.erase(oSize);
+void ThreadPool::runChunks (Job &job) noexcept {
+  for (size_t chunkI; (chunkI = job.nextChunkI.fetch_add(1, std::memory_order_relaxed)) < job.chunkCount; ) {
+    (*job.op)(chunkI);
   }
+}
 
-  Bitset::andOp(o.b, r.b, oSize, o.b);
+void ThreadPool::work () noexcept {
+  size_t seenGeneration = 0;
+  std::unique_lock<std::mutex> lock(m);
+  for (;;) {
+    workCondition.wait(lock, [&] () {
+      return stopping || (job && generation != seenGeneration);
+    });
+    if (stopping) {
+      return;
+    }
+    seenGeneration = generation;
+    Job &j = *job;
+    ++j.workerCount;
+    lock.unlock();
 
-  return o;
-}
+    runChunks(j);
 
-Bitset operator& (const Bitset &l, Bitset &&r) {
-  return move(r) & l;
+    lock.lock();
+    if (--j.workerCount == 0) {
+      doneCondition.notify_all();
+    }
+  }
 }
 
-Bitset operator& (const Bitset &l, const Bitset &r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+void ThreadPool::forEachChunk (size_t chunkCount, const std::function<void (size_t chunkI)> &op) {
+  if (threads.empty() || chunkCount < 2) {
+    for (size_t chunkI = 0; chunkI != chunkCount; ++chunkI) {
+      op(chunkI);
+    }
+    return;
+  }
 
-  size_t oSize = min(lSize, rSize);
-  Bitset o(oSize, false);
+  std::lock_guard<std::mutex> jobLock(jobMutex);
+  Job j;
+  j.op = &op;
+  j.chunkCount = chunkCount;
+  j.nextChunkI.store(0, std::memory_order_relaxed);
+  j.workerCount = 0;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    job = &j;
+    ++generation;
+  }
+  workCondition.notify_all();
 
-  Bitset::andOp(l.b, r.b, oSize, o.b);
+  runChunks(j);
 
-  return o;
+  // Stop any more workers from joining, then wait for those that have to finish their chunks.
+  std::unique_lock<std::mutex> lock(m);
+  job = nullptr;
+  doneCondition.wait(lock, [&] () {
+    return j.workerCount == 0;
+  });
 }
 
-Bitset &Bitset::andNot (Bitset &&r) {
-  *this = andNot(move(*this), move(r));
-  return *this;
+constexpr size_t Parallel::defaultMinBytes;
+
+Parallel::Parallel (ThreadPool &pool, size_t minBytes) noexcept : pool(pool), minBytes(minBytes) {
 }
 
-Bitset &Bitset::andNot (const Bitset &r) {
-  *this = andNot(move(*this), r);
-  return *this;
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+template<typename _Word> constexpr size_t BasicBitset<_Word>::bits;
+template<typename _Word> constexpr _Word BasicBitset<_Word>::one;
+template<typename _Word> constexpr size_t BasicBitset<_Word>::inlineSize;
+template<typename _Word> constexpr size_t BasicBitset<_Word>::nonIndex;
+template<typename _Word> constexpr size_t BasicBitset<_Word>::blockWords;
+template<typename _Word> constexpr size_t BasicBitset<_Word>::scratchWords;
+template<typename _Word> constexpr size_t BasicBitset<_Word>::parallelChunkWords;
+
+template<typename _Word> struct BasicBitset<_Word>::RankDirectory {
+  static constexpr size_t blockWords = 512 / bits;
+
+  /**
+    For each block, the number of bits set in the blocks before it.
+  */
+  vector<size_t> ranks;
+  /**
+    The number of leading elements of ranks that are up to date (treating words beyond the width as zero).
+  */
+  size_t validCount = 0;
+};
+
+template<typename _Word> constexpr size_t BasicBitset<_Word>::RankDirectory::blockWords;
+
+template<typename _Word> struct BasicBitset<_Word>::Summary {
+  /**
+    A bit for each word of the bitset, set if the word is not the empty value, and a bit for each word of those,
+    set if it is non-zero.
+  */
+  struct Level {
+    vector<word> words;
+    vector<word> summary;
+
+    void rebuild (const word *b, size_t size, size_t begin, word empty);
+    /**
+      Returns a word with bit k set if b[k] is not empty, for the count (at most bits) words at b.
+    */
+    static word getNonEmptyMask (const word *b, size_t count, word empty, ScanKernel scanKernel) noexcept;
+    void set (size_t wordI, bool value) noexcept;
+    /**
+      Returns the index of the first word from wordI on whose bit is set, or nonIndex if there is none.
+    */
+    size_t getNext (size_t wordI) const noexcept;
+    /**
+      Returns one more than the index of the last word whose bit is set, or 0 if there is none.
+    */
+    size_t getEnd () const noexcept;
+  };
+
+  Level nonZero;
+  Level nonOnes;
+  /**
+    The size of the bitset when the summary was last caught up with it, and the number of leading words that are
+    still up to date.
+  */
+  size_t size = 0;
+  size_t validCount = 0;
+};
+
+template<typename _Word> void BasicBitset<_Word>::Summary::Level::rebuild (const word *b, size_t size, size_t begin, word empty) {
+  size_t wordCount = (size + bits - 1) / bits;
+  words.resize(wordCount);
+  summary.resize((wordCount + bits - 1) / bits);
+
+  const Kernels &kernels = getKernels();
+  ScanKernel scanKernel = empty == 0 ? kernels.zeroScanKernel : kernels.onesScanKernel;
+  size_t beginWordI = begin / bits;
+  for (size_t i = beginWordI; i != wordCount; ++i) {
+    words[i] = getNonEmptyMask(b + i * bits, min(bits, size - i * bits), empty, scanKernel);
+  }
+  for (size_t k = beginWordI / bits, kEnd = summary.size(); k != kEnd; ++k) {
+    summary[k] = getNonEmptyMask(words.data() + k * bits, min(bits, wordCount - k * bits), 0, kernels.zeroScanKernel);
+  }
 }
 
-Bitset Bitset::andNot (Bitset &&l, Bitset &&r) {
-  return andNot(move(l), r);
+template<typename _Word> typename BasicBitset<_Word>::word BasicBitset<_Word>::Summary::Level::getNonEmptyMask (const word *b, size_t count, word empty, ScanKernel scanKernel) noexcept {
+  // Skip the run when it is all empty (as it mostly is in a sparse bitset), and otherwise compare all of a full run
+  // in a loop of fixed length, which the compiler can turn into vector compares.
+  size_t emptyCount = count >= 2 ? scanKernel(b, count * sizeof(word)) / sizeof(word) : 0;
+  if (emptyCount == count) {
+    return 0;
+  }
+  word w = 0;
+  if (count == bits) {
+    for (iu k = 0; k != bits; ++k) {
+      w |= static_cast<word>(b[k] != empty) << k;
+    }
+  } else {
+    for (size_t k = emptyCount; k != count; ++k) {
+      w |= static_cast<word>(b[k] != empty) << k;
+    }
+  }
+  return w;
 }
 
-Bitset Bitset::andNot (Bitset &&l, const Bitset &r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+template<typename _Word> void BasicBitset<_Word>::Summary::Level::set (size_t wordI, bool value) noexcept {
+  size_t i = wordI / bits;
+  word &w = words[i];
+  word mask = one << (wordI % bits);
+  w = value ? w | mask : w & ~mask;
 
-  size_t oSize = min(lSize, rSize);
-  Bitset o(move(l));
+  word &s = summary[i / bits];
+  mask = one << (i % bits);
+  s = w != 0 ? s | mask : s & ~mask;
+}
 
-  Bitset::andNotOp(o.b, lSize, r.b, oSize, o.b);
+template<typename _Word> size_t BasicBitset<_Word>::Summary::Level::getNext (size_t wordI) const noexcept {
+  size_t i = wordI / bits;
+  if (i >= words.size()) {
+    return nonIndex;
+  }
+  word w = words[i] >> (wordI % bits);
+  if (w != 0) {
+    return wordI + getLowestSetBit(w);
+  }
 
-  return o;
+  size_t nextI = BasicBitset::getNextSetBit(summary.data(), summary.size(), i + 1);
+  if (nextI == nonIndex) {
+    return nonIndex;
+  }
+  return nextI * bits + getLowestSetBit(words[nextI]);
 }
 
-Bitset Bitset::andNot (const Bitset &l, Bitset &&r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+template<typename _Word> size_t BasicBitset<_Word>::Summary::Level::getEnd () const noexcept {
+  size_t k = summary.size();
+  if (k >= 2) {
+    k -= getKernels().zeroScanBackKernel(summary.data(), k * sizeof(word)) / sizeof(word);
+  }
+  for (; k != 0; --k) {
+    word s = summary[k - 1];
+    if (s != 0) {
+      size_t i = (k - 1) * bits + getHighestSetBit(s);
+      return i * bits + getHighestSetBit(words[i]) + 1;
+    }
+  }
+  return 0;
+}
 
-  if (r.b.capacity() < lSize) {
-    DA(rSize < lSize);
-    Bitset o(lSize, false);
+template<typename _Word> BasicBitset<_Word>::BasicBitset () : usedSize(nonIndex), trimPolicy(TrimPolicy::TRIM), minSize(0), cachingHash(false), cachedHash(0) {
+}
 
-    Bitset::andNotOp(l.b, lSize, r.b, rSize, o.b);
+template<typename _Word> BasicBitset<_Word>::BasicBitset (WordAllocator &allocator) noexcept : b(&allocator), usedSize(nonIndex), trimPolicy(TrimPolicy::TRIM), minSize(0), cachingHash(false), cachedHash(0) {
+}
 
-    return o;
+template<typename _Word> BasicBitset<_Word>::BasicBitset (size_t width) : b((width + (bits - 1)) / bits), usedSize(nonIndex), trimPolicy(TrimPolicy::TRIM), minSize(0), cachingHash(false), cachedHash(0) {
+  ensureWidth(width);
+}
+
+template<typename _Word> BasicBitset<_Word>::BasicBitset (size_t size, bool) : b(size), usedSize(nonIndex), trimPolicy(TrimPolicy::TRIM), minSize(0), cachingHash(false), cachedHash(0) {
+  b.append_any(size);
+}
+
+template<typename _Word> BasicBitset<_Word>::BasicBitset (const BasicBitset &o) : b(o.b), rankDirectory(o.rankDirectory ? new RankDirectory(*o.rankDirectory) : nullptr), summary(o.summary ? new Summary(*o.summary) : nullptr), usedSize(o.usedSize.load(std::memory_order_relaxed)), trimPolicy(o.trimPolicy), minSize(o.minSize), cachingHash(o.cachingHash), cachedHash(o.cachedHash.load(std::memory_order_relaxed)) {
+}
+
+template<typename _Word> BasicBitset<_Word>::BasicBitset (BasicBitset &&o) noexcept : b(move(o.b)), rankDirectory(move(o.rankDirectory)), summary(move(o.summary)), usedSize(o.usedSize.load(std::memory_order_relaxed)), trimPolicy(o.trimPolicy), minSize(o.minSize), cachingHash(o.cachingHash), cachedHash(o.cachedHash.load(std::memory_order_relaxed)) {
+  o.usedSize.store(0, std::memory_order_relaxed);
+  o.minSize = 0;
+  o.cachedHash.store(0, std::memory_order_relaxed);
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator= (const BasicBitset &o) {
+  b = o.b;
+  rankDirectory.reset(o.rankDirectory ? new RankDirectory(*o.rankDirectory) : nullptr);
+  summary.reset(o.summary ? new Summary(*o.summary) : nullptr);
+  usedSize.store(o.usedSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  trimPolicy = o.trimPolicy;
+  minSize = o.minSize;
+  cachingHash = o.cachingHash;
+  cachedHash.store(o.cachedHash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator= (BasicBitset &&o) {
+  if (this == &o) {
+    return *this;
+  }
+
+  b = move(o.b);
+  rankDirectory = move(o.rankDirectory);
+  summary = move(o.summary);
+  usedSize.store(o.usedSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  trimPolicy = o.trimPolicy;
+  minSize = o.minSize;
+  cachingHash = o.cachingHash;
+  cachedHash.store(o.cachedHash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  // (o's words are all gone.)
+  o.usedSize.store(0, std::memory_order_relaxed);
+  o.minSize = 0;
+  o.cachedHash.store(0, std::memory_order_relaxed);
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word>::~BasicBitset () noexcept = default;
+
+template<typename _Word> WordAllocator *BasicBitset<_Word>::getAllocator () const noexcept {
+  return b.getAllocator();
+}
+
+template<typename _Word> void BasicBitset<_Word>::enableSharing () noexcept {
+  b.setSharing(true);
+}
+
+template<typename _Word> void BasicBitset<_Word>::disableSharing () {
+  b.setSharing(false);
+}
+
+template<typename _Word> bool BasicBitset<_Word>::sharesWords (const BasicBitset &o) const noexcept {
+  const Words &bRef = b;
+  const Words &oRef = o.b;
+  return bRef.data() == oRef.data() && bRef.size() == oRef.size();
+}
+
+template<typename _Word> void BasicBitset<_Word>::ensureWidth (size_t width) {
+  if (width != 0) {
+    ensureWidthForWord((width - 1) / bits);
+    minSize = max(minSize, (width - 1) / bits + 1);
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::reserveSize (size_t size) {
+  size_t capacity = b.capacity();
+  if (size > capacity) {
+    b.reserve(max(size, capacity * 2));
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::setSizeAny (size_t size) {
+  size_t bSize = b.size();
+  if (size > bSize) {
+    reserveSize(size);
+    b.append_any(size - bSize);
+  } else {
+    b.erase(size);
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::ensureWidthForWord (size_t wordI) {
+  size_t bSize = b.size();
+  if (wordI >= bSize) {
+    reserveSize(wordI + 1);
+    b.append(wordI + 1 - bSize, 0);
+  }
+}
+
+template<typename _Word> bool BasicBitset<_Word>::wordIsWithinWidth (size_t wordI) const noexcept {
+  return wordI < b.size();
+}
+
+template<typename _Word> void BasicBitset<_Word>::setExistingBit (size_t i) {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  DPRE(wordIsWithinWidth(wordI));
+  b[wordI] |= one << bitI;
+  noteWordChange(wordI);
+}
+
+template<typename _Word> void BasicBitset<_Word>::setBit (size_t i) {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  ensureWidthForWord(wordI);
+  b[wordI] |= one << bitI;
+  noteWordChange(wordI);
+}
+
+template<typename _Word> void BasicBitset<_Word>::clearExistingBit (size_t i) {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  DPRE(wordIsWithinWidth(wordI));
+  b[wordI] &= ~(one << bitI);
+  noteWordChange(wordI);
+}
+
+template<typename _Word> void BasicBitset<_Word>::clearBit (size_t i) {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  if (wordIsWithinWidth(wordI)) {
+    b[wordI] &= ~(one << bitI);
+    noteWordChange(wordI);
+  }
+}
+
+template<typename _Word> bool BasicBitset<_Word>::getExistingBit (size_t i) const noexcept {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  DPRE(wordIsWithinWidth(wordI));
+  return (b[wordI] >> bitI) & 0b1;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::getBit (size_t i) const noexcept {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  return wordIsWithinWidth(wordI) ? (b[wordI] >> bitI) & 0b1 : 0;
+}
+
+template<typename _Word> template<typename _OutOfRangeResult, typename _ReadOp> size_t BasicBitset<_Word>::getNextBit (const word *b, size_t size, size_t i, const _OutOfRangeResult &outOfRangeResult, ScanKernel scanKernel, const _ReadOp &readOp) noexcept {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  if (wordI >= size) {
+    return outOfRangeResult(i);
+  }
+
+  // Check for a bit in the remainder of the word.
+  word remainder = readOp(b[wordI]) >> bitI;
+  iu lowI = getLowestSetBit(remainder);
+  if (lowI < bits) {
+    return i + lowI;
+  }
+
+  // Look at the following words and find the first non-zero one.
+  DA(remainder == 0);
+  size_t begin = wordI + 1;
+  size_t end = size;
+  if (end - begin >= 2) {
+    begin += scanKernel(b + begin, (end - begin) * sizeof(word)) / sizeof(word);
+  }
+  for (; begin != end; ++begin) {
+    remainder = readOp(b[begin]);
+    if (remainder != 0) {
+      // Get the bit out of it (since there is one).
+      lowI = getLowestSetBit(remainder);
+      DA(lowI < bits);
+      return begin * bits + lowI;
+    }
+  }
+
+  DA(end == begin);
+  return outOfRangeResult(end * bits);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getNextSetBit (const word *b, size_t size, size_t i) noexcept {
+  return getNextBit(b, size, i, [] (size_t i) -> size_t {
+    return nonIndex;
+  }, getKernels().zeroScanKernel, [] (word w) -> word {
+    return w;
+  });
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getNextClearBit (const word *b, size_t size, size_t i) noexcept {
+  return getNextBit(b, size, i, [] (size_t i) -> size_t {
+    return i;
+  }, getKernels().onesScanKernel, [] (word w) -> word {
+    return ~w;
+  });
+}
+
+template<typename _Word> template<typename _ReadOp> size_t BasicBitset<_Word>::getPrevBit (const word *b, size_t size, size_t i, ScanKernel scanKernel, const _ReadOp &readOp) noexcept {
+  if (i == nonIndex) {
+    return nonIndex;
+  }
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  if (wordI >= size) {
+    // (The bits beyond the width are clear.)
+    if (readOp(static_cast<word>(0)) != 0) {
+      return i;
+    }
+    if (size == 0) {
+      return nonIndex;
+    }
+    wordI = size - 1;
+    bitI = bits - 1;
+  }
+
+  // Check for a bit in the part of the word up to the bit.
+  iu shift = static_cast<iu>(bits - 1 - bitI);
+  word remainder = static_cast<word>(readOp(b[wordI]) << shift);
+  iu highI = getHighestSetBit(remainder);
+  if (highI < bits) {
+    return wordI * bits + highI - shift;
+  }
+
+  // Look at the preceding words and find the last non-zero one.
+  DA(remainder == 0);
+  size_t end = wordI;
+  if (end >= 2) {
+    end -= scanKernel(b, end * sizeof(word)) / sizeof(word);
+  }
+  for (; end != 0; --end) {
+    remainder = readOp(b[end - 1]);
+    if (remainder != 0) {
+      highI = getHighestSetBit(remainder);
+      DA(highI < bits);
+      return (end - 1) * bits + highI;
+    }
+  }
+  return nonIndex;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getPrevSetBit (const word *b, size_t size, size_t i) noexcept {
+  return getPrevBit(b, size, i, getKernels().zeroScanBackKernel, [] (word w) -> word {
+    return w;
+  });
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getPrevClearBit (const word *b, size_t size, size_t i) noexcept {
+  return getPrevBit(b, size, i, getKernels().onesScanBackKernel, [] (word w) -> word {
+    return static_cast<word>(~w);
+  });
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getPrevSetBit (size_t i) const noexcept {
+  // (Start below any zero words at the top.)
+  return getPrevSetBit(b.data(), getUsedSize(), i);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getPrevClearBit (size_t i) const noexcept {
+  return getPrevClearBit(b.data(), b.size(), i);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getHighestSetBit () const noexcept {
+  size_t size = getUsedSize();
+  return size == 0 ? nonIndex : (size - 1) * bits + getHighestSetBit(b[size - 1]);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getNextSetBit (size_t i) const noexcept {
+  if (!summary) {
+    return getNextSetBit(b.data(), b.size(), i);
+  }
+
+  updateSummaryIndex();
+  size_t wordI = i / bits;
+  if (!wordIsWithinWidth(wordI)) {
+    return nonIndex;
+  }
+  word remainder = b[wordI] >> (i % bits);
+  if (remainder != 0) {
+    return i + getLowestSetBit(remainder);
+  }
+  size_t nextI = summary->nonZero.getNext(wordI + 1);
+  return nextI == nonIndex ? nonIndex : nextI * bits + getLowestSetBit(b[nextI]);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getNextClearBit (size_t i) const noexcept {
+  if (!summary) {
+    return getNextClearBit(b.data(), b.size(), i);
+  }
+
+  updateSummaryIndex();
+  size_t wordI = i / bits;
+  if (!wordIsWithinWidth(wordI)) {
+    return i;
+  }
+  word remainder = static_cast<word>(~b[wordI]) >> (i % bits);
+  if (remainder != 0) {
+    return i + getLowestSetBit(remainder);
+  }
+  size_t nextI = summary->nonOnes.getNext(wordI + 1);
+  return nextI == nonIndex ? b.size() * bits : nextI * bits + getLowestSetBit(static_cast<word>(~b[nextI]));
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::decode (iu32 *r_o) const noexcept {
+  const word *b = this->b.data();
+  size_t size = this->b.size();
+  iu32 *o = r_o;
+
+  size_t i = size < 2 ? 0 : getKernels().decodeKernel(b, size * sizeof(word), o) / sizeof(word);
+  for (; i != size; ++i) {
+    for (word w = b[i]; w != 0; w &= w - 1) {
+      *o++ = static_cast<iu32>(i * bits + getLowestSetBit(w));
+    }
+  }
+  return static_cast<size_t>(o - r_o);
+}
+
+template<typename _Word> void BasicBitset<_Word>::clear () noexcept {
+  b.clear();
+  noteChange(0);
+}
+
+template<typename _Word> bool BasicBitset<_Word>::isZero (const word *b, size_t size) noexcept {
+  size_t i = size < 2 ? 0 : getKernels().zeroScanKernel(b, size * sizeof(word)) / sizeof(word);
+  for (; i != size; ++i) {
+    if (b[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::isOnes (const word *b, size_t size) noexcept {
+  size_t i = size < 2 ? 0 : getKernels().onesScanKernel(b, size * sizeof(word)) / sizeof(word);
+  for (; i != size; ++i) {
+    if (b[i] != static_cast<word>(~static_cast<word>(0))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::empty () const noexcept {
+  return getUsedSize() == 0;
+}
+
+template<typename _Word> void BasicBitset<_Word>::compact () {
+  b.erase(getUsedSize());
+  b.shrink_to_fit();
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getUsedSize (const word *b, size_t size) noexcept {
+  while (size != 0 && b[size - 1] == 0) {
+    --size;
+  }
+  return size;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::getUsedSize () const noexcept {
+  size_t size = usedSize.load(std::memory_order_relaxed);
+  if (size == nonIndex) {
+    if (summary) {
+      updateSummaryIndex();
+      size = summary->nonZero.getEnd();
+    } else {
+      size = getUsedSize(b.data(), b.size());
+    }
+    // (Concurrent readers all work out the same value, so it does not matter which store wins.)
+    usedSize.store(size, std::memory_order_relaxed);
+  }
+  return size;
+}
+
+template<typename _Word> void BasicBitset<_Word>::setTrimPolicy (TrimPolicy policy) {
+  trimPolicy = policy;
+  trim();
+}
+
+template<typename _Word> typename BasicBitset<_Word>::TrimPolicy BasicBitset<_Word>::getTrimPolicy () const noexcept {
+  return trimPolicy;
+}
+
+template<typename _Word> void BasicBitset<_Word>::trim () {
+  if (trimPolicy == TrimPolicy::KEEP) {
+    return;
+  }
+
+  // (Never below the width that was asked for, so that the bits within it stay existing bits.)
+  b.erase(max(getUsedSize(), min(minSize, b.size())));
+  if (trimPolicy == TrimPolicy::SHRINK && b.capacity() / 4 > b.size()) {
+    b.shrink_to_fit();
+  }
+}
+
+template<typename _Word> template<typename _EdgeOp, typename _MiddleOp> void BasicBitset<_Word>::forRange (size_t begin, size_t end, const _EdgeOp &edgeOp, const _MiddleOp &middleOp) {
+  DPRE(begin < end);
+  size_t beginWordI = begin / bits;
+  size_t beginBitI = begin % bits;
+  size_t endWordI = end / bits;
+  size_t endBitI = end % bits;
+
+  if (beginWordI == endWordI) {
+    edgeOp(beginWordI, static_cast<word>(((one << endBitI) - 1) & (~static_cast<word>(0) << beginBitI)));
+    return;
+  }
+  if (beginBitI != 0) {
+    edgeOp(beginWordI, static_cast<word>(~static_cast<word>(0) << beginBitI));
+    ++beginWordI;
+  }
+  if (beginWordI != endWordI) {
+    middleOp(beginWordI, endWordI);
+  }
+  if (endBitI != 0) {
+    edgeOp(endWordI, static_cast<word>((one << endBitI) - 1));
+  }
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::clampToWidth (size_t i) const noexcept {
+  size_t width = b.size() * bits;
+  return i < width ? i : width;
+}
+
+template<typename _Word> void BasicBitset<_Word>::setRange (size_t begin, size_t end) {
+  if (begin >= end) {
+    return;
+  }
+
+  ensureWidthForWord((end - 1) / bits);
+  forRange(begin, end, [&] (size_t wordI, word mask) {
+    b[wordI] |= mask;
+  }, [&] (size_t beginWordI, size_t endWordI) {
+    fill(&b[beginWordI], &b[0] + endWordI, static_cast<word>(~static_cast<word>(0)));
+  });
+  noteChange(begin / bits);
+}
+
+template<typename _Word> void BasicBitset<_Word>::clearRange (size_t begin, size_t end) {
+  end = clampToWidth(end);
+  if (begin >= end) {
+    return;
+  }
+
+  forRange(begin, end, [&] (size_t wordI, word mask) {
+    b[wordI] &= ~mask;
+  }, [&] (size_t beginWordI, size_t endWordI) {
+    fill(&b[beginWordI], &b[0] + endWordI, 0);
+  });
+  noteChange(begin / bits);
+}
+
+template<typename _Word> void BasicBitset<_Word>::flipRange (size_t begin, size_t end) {
+  if (begin >= end) {
+    return;
+  }
+
+  ensureWidthForWord((end - 1) / bits);
+  forRange(begin, end, [&] (size_t wordI, word mask) {
+    b[wordI] ^= mask;
+  }, [&] (size_t beginWordI, size_t endWordI) {
+    for (word *i = &b[beginWordI], *iEnd = &b[0] + endWordI; i != iEnd; ++i) {
+      *i = ~*i;
+    }
+  });
+  noteChange(begin / bits);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::countRange (size_t begin, size_t end) const noexcept {
+  end = clampToWidth(end);
+  if (begin >= end) {
+    return 0;
+  }
+
+  size_t count = 0;
+  forRange(begin, end, [&] (size_t wordI, word mask) {
+    count += getSetBitCount(static_cast<word>(b[wordI] & mask));
+  }, [&] (size_t beginWordI, size_t endWordI) {
+    count += countBits(b.data() + beginWordI, endWordI - beginWordI);
+  });
+  return count;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::anyInRange (size_t begin, size_t end) const noexcept {
+  end = clampToWidth(end);
+  if (begin >= end) {
+    return false;
+  }
+
+  bool any = false;
+  forRange(begin, end, [&] (size_t wordI, word mask) {
+    any = any || (b[wordI] & mask) != 0;
+  }, [&] (size_t beginWordI, size_t endWordI) {
+    any = any || !isZero(b.data() + beginWordI, endWordI - beginWordI);
+  });
+  return any;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::allInRange (size_t begin, size_t end) const noexcept {
+  if (begin >= end) {
+    return true;
+  }
+  if (end > b.size() * bits) {
+    return false;
+  }
+
+  bool all = true;
+  forRange(begin, end, [&] (size_t wordI, word mask) {
+    all = all && (b[wordI] & mask) == mask;
+  }, [&] (size_t beginWordI, size_t endWordI) {
+    all = all && isOnes(b.data() + beginWordI, endWordI - beginWordI);
+  });
+  return all;
+}
+
+template<typename _Word> void BasicBitset<_Word>::noteChange (size_t wordI) const noexcept {
+  if (rankDirectory) {
+    rankDirectory->validCount = min(rankDirectory->validCount, wordI / RankDirectory::blockWords + 1);
+  }
+  if (summary) {
+    summary->validCount = min(summary->validCount, wordI);
+  }
+  usedSize.store(nonIndex, std::memory_order_relaxed);
+  cachedHash.store(0, std::memory_order_relaxed);
+}
+
+template<typename _Word> void BasicBitset<_Word>::noteWordChange (size_t wordI) const noexcept {
+  if (rankDirectory) {
+    rankDirectory->validCount = min(rankDirectory->validCount, wordI / RankDirectory::blockWords + 1);
+  }
+  if (summary && wordI < summary->validCount) {
+    summary->nonZero.set(wordI, b[wordI] != 0);
+    summary->nonOnes.set(wordI, b[wordI] != static_cast<word>(~static_cast<word>(0)));
+  }
+  size_t size = usedSize.load(std::memory_order_relaxed);
+  if (size != nonIndex) {
+    if (b[wordI] != 0) {
+      usedSize.store(max(size, wordI + 1), std::memory_order_relaxed);
+    } else if (wordI + 1 == size) {
+      usedSize.store(getUsedSize(b.data(), wordI), std::memory_order_relaxed);
+    }
+  }
+  cachedHash.store(0, std::memory_order_relaxed);
+}
+
+template<typename _Word> void BasicBitset<_Word>::enableRankIndex () {
+  if (!rankDirectory) {
+    rankDirectory.reset(new RankDirectory());
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::disableRankIndex () noexcept {
+  rankDirectory.reset();
+}
+
+template<typename _Word> void BasicBitset<_Word>::refreshRankIndex () {
+  if (rankDirectory) {
+    updateRankIndex(b.size() / RankDirectory::blockWords + 1);
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::enableSummaryIndex () {
+  if (!summary) {
+    summary.reset(new Summary());
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::disableSummaryIndex () noexcept {
+  summary.reset();
+}
+
+template<typename _Word> void BasicBitset<_Word>::refreshSummaryIndex () {
+  if (summary) {
+    updateSummaryIndex();
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::updateSummaryIndex () const {
+  Summary &s = *summary;
+  size_t size = b.size();
+  size_t begin = min(s.validCount, size);
+  if (begin == size && s.size == size) {
+    return;
+  }
+
+  s.nonZero.rebuild(b.data(), size, begin, 0);
+  s.nonOnes.rebuild(b.data(), size, begin, static_cast<word>(~static_cast<word>(0)));
+  s.size = size;
+  s.validCount = size;
+}
+
+template<typename _Word> void BasicBitset<_Word>::updateRankIndex (size_t blockCount) const {
+  RankDirectory &d = *rankDirectory;
+  DPRE(blockCount <= b.size() / RankDirectory::blockWords + 1);
+  if (d.validCount >= blockCount) {
+    return;
+  }
+
+  if (d.ranks.size() < blockCount) {
+    d.ranks.resize(blockCount);
+  }
+  if (d.validCount == 0) {
+    d.ranks[0] = 0;
+    d.validCount = 1;
+  }
+  for (size_t i = d.validCount; i != blockCount; ++i) {
+    d.ranks[i] = d.ranks[i - 1] + countBits(b.data() + (i - 1) * RankDirectory::blockWords, RankDirectory::blockWords);
+  }
+  d.validCount = blockCount;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::countBits (const word *b, size_t size) noexcept {
+  size_t count = 0;
+  size_t i = size < 2 ? 0 : getKernels().countKernel(b, size * sizeof(word), count) / sizeof(word);
+  for (; i != size; ++i) {
+    count += getSetBitCount(b[i]);
+  }
+  return count;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::count () const noexcept {
+  return countBits(b.data(), b.size());
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::rank (size_t i) const {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+  if (!wordIsWithinWidth(wordI)) {
+    wordI = b.size();
+    bitI = 0;
+  }
+
+  size_t r = 0;
+  size_t begin = 0;
+  if (rankDirectory) {
+    size_t blockI = wordI / RankDirectory::blockWords;
+    updateRankIndex(blockI + 1);
+    r = rankDirectory->ranks[blockI];
+    begin = blockI * RankDirectory::blockWords;
+  }
+  r += countBits(b.data() + begin, wordI - begin);
+  if (bitI != 0) {
+    r += getSetBitCount(b[wordI] & ((one << bitI) - 1));
+  }
+  return r;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::select (size_t k) const {
+  size_t end = b.size();
+  size_t wordI = 0;
+  if (rankDirectory) {
+    // Find the last block that starts with fewer than k + 1 bits set before it.
+    size_t blockCount = end / RankDirectory::blockWords + 1;
+    updateRankIndex(blockCount);
+    const size_t *ranks = rankDirectory->ranks.data();
+    size_t blockI = static_cast<size_t>(upper_bound(ranks, ranks + blockCount, k) - ranks) - 1;
+    k -= ranks[blockI];
+    wordI = blockI * RankDirectory::blockWords;
+  }
+
+  for (; wordI != end; ++wordI) {
+    word w = b[wordI];
+    size_t wCount = getSetBitCount(w);
+    if (k < wCount) {
+      for (; k != 0; --k) {
+        w &= w - 1;
+      }
+      return wordI * bits + getLowestSetBit(w);
+    }
+    k -= wCount;
+  }
+  return nonIndex;
+}
+
+template<typename _Word> template<typename _MergeOp> void BasicBitset<_Word>::op (
+  const word *i0, const word *i1, size_t iSize, word *r_o, Kernel kernel, _MergeOp mergeOp
+) noexcept {
+  size_t begin = iSize < 2 ? 0 : kernel(i0, i1, iSize * sizeof(word), r_o) / sizeof(word);
+  for (size_t i = begin; i != iSize; ++i) {
+    r_o[i] = mergeOp(i0[i], i1[i]);
+  }
+}
+
+template<typename _Word> template<typename _MergeOp> void BasicBitset<_Word>::op (
+  const Words &i0, const Words &i1, size_t iSize,
+  Words &r_o, Kernel kernel, _MergeOp mergeOp
+) {
+  DPRE(r_o.size() >= iSize, "r_o must have size at least that of the smaller of the inputs");
+
+  if (iSize != 0) {
+    op(i0.data(), i1.data(), iSize, &r_o[0], kernel, mergeOp);
+  }
+}
+
+template<typename _Word> template<typename _MergeOp, typename _RemainderOp> void BasicBitset<_Word>::op (
+  const Words &i0, size_t i0Size, const Words &i1, size_t i1Size,
+  Words &r_o, Kernel kernel, _MergeOp mergeOp, _RemainderOp remainderOp
+) {
+  DPRE(i0Size >= i1Size);
+  DPRE(r_o.size() >= i0Size, "r_o must have size at least that of the bigger of the inputs");
+
+  op(i0, i1, i1Size, r_o, kernel, mergeOp);
+  for (size_t i = i1Size; i != i0Size; ++i) {
+    r_o[i] = remainderOp(i0[i]);
+  }
+}
+
+template<typename _Word> void BasicBitset<_Word>::orOp (const Words &i0, size_t i0Size, const Words &i1, size_t i1Size, Words &r_o) {
+  DPRE(i0Size >= i1Size);
+  DPRE(r_o.size() == i0Size);
+  BasicBitset::op(i0, i0Size, i1, i1Size, r_o, getKernels().orKernel, [] (word v0, word v1) -> word {
+    return v0 | v1;
+  }, [] (word o) -> word {
+    return o;
+  });
+}
+
+template<typename _Word> void BasicBitset<_Word>::xorOp (const Words &i0, size_t i0Size, const Words &i1, size_t i1Size, Words &r_o) {
+  DPRE(i0Size >= i1Size);
+  DPRE(r_o.size() == i0Size);
+  BasicBitset::op(i0, i0Size, i1, i1Size, r_o, getKernels().xorKernel, [] (word v0, word v1) -> word {
+    return v0 ^ v1;
+  }, [] (word o) -> word {
+    return o;
+  });
+}
+
+template<typename _Word> void BasicBitset<_Word>::andOp (const Words &i0, const Words &i1, size_t iSize, Words &r_o) {
+  DPRE(r_o.size() == iSize);
+  BasicBitset::op(i0, i1, iSize, r_o, getKernels().andKernel, [] (word v0, word v1) -> word {
+    return v0 & v1;
+  });
+}
+
+template<typename _Word> void BasicBitset<_Word>::andNotOp (const Words &i0, size_t i0Size, const Words &i1, size_t i1Size, Words &r_o) {
+  DPRE(i0Size >= i1Size);
+  DPRE(r_o.size() == i0Size);
+  BasicBitset::op(i0, i0Size, i1, i1Size, r_o, getKernels().andNotKernel, [] (word v0, word v1) -> word {
+    return v0 & ~v1;
+  }, [] (word o) -> word {
+    return o;
+  });
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator|= (BasicBitset &&r) {
+  if (b.size() < r.b.size() && b.capacity() < r.b.size() && b.getAllocator() == r.b.getAllocator()) {
+    // Take r's storage rather than growing ours.
+    swap(b, r.b);
+    r.noteChange(0);
+  }
+  return *this |= static_cast<const BasicBitset &>(r);
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator|= (const BasicBitset &r) {
+  if (sharesWords(r)) {
+    return *this;
+  }
+
+  size_t lSize = b.size();
+  size_t rSize = r.b.size();
+  if (lSize < rSize) {
+    setSizeAny(rSize);
+    copy(r.b.data() + lSize, r.b.data() + rSize, &b[lSize]);
+  }
+
+  size_t size = min(lSize, rSize);
+  if (size != 0) {
+    op(b.data(), r.b.data(), size, &b[0], getKernels().orKernel, [] (word v0, word v1) -> word {
+      return v0 | v1;
+    });
+  }
+  noteChange(0);
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> operator| (BasicBitset<_Word> &&l, BasicBitset<_Word> &&r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  if (lSize < rSize) {
+    BasicBitset<_Word> o(move(r));
+
+    BasicBitset<_Word>::orOp(o.b, rSize, l.b, lSize, o.b);
+    o.noteChange(0);
+
+    return o;
+  } else {
+    BasicBitset<_Word> o(move(l));
+
+    BasicBitset<_Word>::orOp(o.b, lSize, r.b, rSize, o.b);
+    o.noteChange(0);
+
+    return o;
+  }
+}
+
+template<typename _Word> BasicBitset<_Word> operator| (BasicBitset<_Word> &&l, const BasicBitset<_Word> &r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  if (l.b.capacity() < rSize) {
+    DA(lSize < rSize);
+    BasicBitset<_Word> o(rSize, false);
+
+    BasicBitset<_Word>::orOp(r.b, rSize, l.b, lSize, o.b);
+    o.noteChange(0);
+
+    return o;
+  } else {
+    BasicBitset<_Word> o(move(l));
+    const typename BasicBitset<_Word>::Words *i0 = &o.b;
+    size_t i0Size = lSize;
+    const typename BasicBitset<_Word>::Words *i1 = &r.b;
+    size_t i1Size = rSize;
+    if (lSize < rSize) {
+      i0 = &r.b;
+      i0Size = rSize;
+      i1 = &o.b;
+      i1Size = lSize;
+      o.b.append_any(rSize - lSize);
+    }
+
+    BasicBitset<_Word>::orOp(*i0, i0Size, *i1, i1Size, o.b);
+    o.noteChange(0);
+
+    return o;
+  }
+}
+
+template<typename _Word> BasicBitset<_Word> operator| (const BasicBitset<_Word> &l, BasicBitset<_Word> &&r) {
+  return move(r) | l;
+}
+
+template<typename _Word> BasicBitset<_Word> operator| (const BasicBitset<_Word> &l, const BasicBitset<_Word> &r) {
+  if (l.sharesWords(r)) {
+    return l;
+  }
+
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  const typename BasicBitset<_Word>::Words *i0 = &l.b;
+  size_t i0Size = lSize;
+  const typename BasicBitset<_Word>::Words *i1 = &r.b;
+  size_t i1Size = rSize;
+  if (lSize < rSize) {
+    i0 = &r.b;
+    i0Size = rSize;
+    i1 = &l.b;
+    i1Size = lSize;
+  }
+  BasicBitset<_Word> o(i0Size, false);
+
+  BasicBitset<_Word>::orOp(*i0, i0Size, *i1, i1Size, o.b);
+  o.noteChange(0);
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator&= (BasicBitset &&r) {
+  return *this &= static_cast<const BasicBitset &>(r);
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator&= (const BasicBitset &r) {
+  if (sharesWords(r)) {
+    return *this;
+  }
+
+  size_t rSize = r.b.size();
+  if (b.size() > rSize) {
+    b.erase(rSize);
+  }
+
+  BasicBitset::andOp(b, r.b, b.size(), b);
+  noteChange(0);
+  trim();
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> operator& (BasicBitset<_Word> &&l, BasicBitset<_Word> &&r) {
+  return move(l) & r;
+}
+
+template<typename _Word> BasicBitset<_Word> operator& (BasicBitset<_Word> &&l, const BasicBitset<_Word> &r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  BasicBitset<_Word> o(move(l));
+  size_t oSize;
+  if (lSize < rSize) {
+    oSize = lSize;
+  } else {
+    oSize = rSize;
+    o.b.erase(oSize);
+  }
+
+  BasicBitset<_Word>::andOp(o.b, r.b, oSize, o.b);
+  o.noteChange(0);
+  o.trim();
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> operator& (const BasicBitset<_Word> &l, BasicBitset<_Word> &&r) {
+  return move(r) & l;
+}
+
+template<typename _Word> BasicBitset<_Word> operator& (const BasicBitset<_Word> &l, const BasicBitset<_Word> &r) {
+  if (l.sharesWords(r)) {
+    return l;
+  }
+
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  size_t oSize = min(lSize, rSize);
+  BasicBitset<_Word> o(oSize, false);
+
+  BasicBitset<_Word>::andOp(l.b, r.b, oSize, o.b);
+  o.noteChange(0);
+  o.trim();
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::andNot (BasicBitset &&r) {
+  return andNot(static_cast<const BasicBitset &>(r));
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::andNot (const BasicBitset &r) {
+  if (sharesWords(r)) {
+    b.clear();
+    noteChange(0);
+    trim();
+    return *this;
+  }
+
+  size_t lSize = b.size();
+  size_t rSize = r.b.size();
+
+  BasicBitset::andNotOp(b, lSize, r.b, min(lSize, rSize), b);
+  noteChange(0);
+  trim();
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::andNot (BasicBitset &&l, BasicBitset &&r) {
+  return andNot(move(l), r);
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::andNot (BasicBitset &&l, const BasicBitset &r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  size_t oSize = min(lSize, rSize);
+  BasicBitset o(move(l));
+
+  BasicBitset::andNotOp(o.b, lSize, r.b, oSize, o.b);
+  o.noteChange(0);
+  o.trim();
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::andNot (const BasicBitset &l, BasicBitset &&r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  if (r.b.capacity() < lSize) {
+    DA(rSize < lSize);
+    BasicBitset o(lSize, false);
+
+    BasicBitset::andNotOp(l.b, lSize, r.b, rSize, o.b);
+    o.noteChange(0);
+    o.trim();
+
+    return o;
+  } else {
+    BasicBitset o(move(r));
+    size_t oSize;
+    if (rSize < lSize) {
+      o.b.append_any(lSize - rSize);
+      oSize = rSize;
+    } else {
+      oSize = lSize;
+      o.b.erase(oSize);
+    }
+
+    BasicBitset::andNotOp(l.b, lSize, o.b, oSize, o.b);
+    o.noteChange(0);
+    o.trim();
+
+    return o;
+  }
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::andNot (const BasicBitset &l, const BasicBitset &r) {
+  if (l.sharesWords(r)) {
+    return BasicBitset();
+  }
+
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  size_t oSize = min(lSize, rSize);
+  BasicBitset o(lSize, false);
+
+  BasicBitset::andNotOp(l.b, lSize, r.b, oSize, o.b);
+  o.noteChange(0);
+  o.trim();
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator^= (BasicBitset &&r) {
+  if (b.size() < r.b.size() && b.capacity() < r.b.size() && b.getAllocator() == r.b.getAllocator()) {
+    // Take r's storage rather than growing ours.
+    swap(b, r.b);
+    r.noteChange(0);
+  }
+  return *this ^= static_cast<const BasicBitset &>(r);
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator^= (const BasicBitset &r) {
+  if (sharesWords(r)) {
+    b.clear();
+    noteChange(0);
+    return *this;
+  }
+
+  size_t lSize = b.size();
+  size_t rSize = r.b.size();
+  if (lSize < rSize) {
+    setSizeAny(rSize);
+    copy(r.b.data() + lSize, r.b.data() + rSize, &b[lSize]);
+  }
+
+  size_t size = min(lSize, rSize);
+  if (size != 0) {
+    op(b.data(), r.b.data(), size, &b[0], getKernels().xorKernel, [] (word v0, word v1) -> word {
+      return v0 ^ v1;
+    });
+  }
+  noteChange(0);
+  trim();
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> operator^ (BasicBitset<_Word> &&l, BasicBitset<_Word> &&r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  if (lSize < rSize) {
+    BasicBitset<_Word> o(move(r));
+
+    BasicBitset<_Word>::xorOp(o.b, rSize, l.b, lSize, o.b);
+    o.noteChange(0);
+    o.trim();
+
+    return o;
+  } else {
+    BasicBitset<_Word> o(move(l));
+
+    BasicBitset<_Word>::xorOp(o.b, lSize, r.b, rSize, o.b);
+    o.noteChange(0);
+    o.trim();
+
+    return o;
+  }
+}
+
+template<typename _Word> BasicBitset<_Word> operator^ (BasicBitset<_Word> &&l, const BasicBitset<_Word> &r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  if (l.b.capacity() < rSize) {
+    DA(lSize < rSize);
+    BasicBitset<_Word> o(rSize, false);
+
+    BasicBitset<_Word>::xorOp(r.b, rSize, l.b, lSize, o.b);
+    o.noteChange(0);
+    o.trim();
+
+    return o;
+  } else {
+    BasicBitset<_Word> o(move(l));
+    const typename BasicBitset<_Word>::Words *i0 = &o.b;
+    size_t i0Size = lSize;
+    const typename BasicBitset<_Word>::Words *i1 = &r.b;
+    size_t i1Size = rSize;
+    if (lSize < rSize) {
+      i0 = &r.b;
+      i0Size = rSize;
+      i1 = &o.b;
+      i1Size = lSize;
+      o.b.append_any(rSize - lSize);
+    }
+
+    BasicBitset<_Word>::xorOp(*i0, i0Size, *i1, i1Size, o.b);
+    o.noteChange(0);
+    o.trim();
+
+    return o;
+  }
+}
+
+template<typename _Word> BasicBitset<_Word> operator^ (const BasicBitset<_Word> &l, BasicBitset<_Word> &&r) {
+  return move(r) ^ l;
+}
+
+template<typename _Word> BasicBitset<_Word> operator^ (const BasicBitset<_Word> &l, const BasicBitset<_Word> &r) {
+  if (l.sharesWords(r)) {
+    return BasicBitset<_Word>();
+  }
+
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  const typename BasicBitset<_Word>::Words *i0 = &l.b;
+  size_t i0Size = lSize;
+  const typename BasicBitset<_Word>::Words *i1 = &r.b;
+  size_t i1Size = rSize;
+  if (lSize < rSize) {
+    i0 = &r.b;
+    i0Size = rSize;
+    i1 = &l.b;
+    i1Size = lSize;
+  }
+  BasicBitset<_Word> o(i0Size, false);
+
+  BasicBitset<_Word>::xorOp(*i0, i0Size, *i1, i1Size, o.b);
+  o.noteChange(0);
+  o.trim();
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::flip (size_t width) {
+  flipRange(0, width);
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::flip (BasicBitset &&l, size_t width) {
+  BasicBitset o(move(l));
+  o.flip(width);
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::flip (const BasicBitset &l, size_t width) {
+  return flip(BasicBitset(l), width);
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator<<= (size_t k) {
+  size_t size = b.size();
+  if (size == 0 || k == 0) {
+    return *this;
+  }
+  size_t wordShift = k / bits;
+  size_t bitShift = k % bits;
+  size_t oSize = size + wordShift + (bitShift != 0);
+
+  setSizeAny(oSize);
+  // Work down from the top, so that each word is read before it is overwritten.
+  word *o = &b[0];
+  for (size_t i = oSize - 1; i != wordShift - 1; --i) {
+    size_t srcI = i - wordShift;
+    word hi = srcI < size ? o[srcI] : 0;
+    if (bitShift == 0) {
+      o[i] = hi;
+    } else {
+      word lo = srcI != 0 && srcI - 1 < size ? o[srcI - 1] : 0;
+      o[i] = static_cast<word>(hi << bitShift) | static_cast<word>(lo >> (bits - bitShift));
+    }
+  }
+  fill(o, o + wordShift, 0);
+  noteChange(0);
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> &BasicBitset<_Word>::operator>>= (size_t k) {
+  size_t size = b.size();
+  size_t wordShift = k / bits;
+  size_t bitShift = k % bits;
+  if (wordShift >= size) {
+    b.erase(0);
+    noteChange(0);
+    return *this;
+  }
+  size_t oSize = size - wordShift;
+
+  word *o = &b[0];
+  for (size_t i = 0; i != oSize; ++i) {
+    word lo = o[i + wordShift];
+    if (bitShift == 0) {
+      o[i] = lo;
+    } else {
+      word hi = i + wordShift + 1 < size ? o[i + wordShift + 1] : 0;
+      o[i] = static_cast<word>(lo >> bitShift) | static_cast<word>(hi << (bits - bitShift));
+    }
+  }
+  b.erase(oSize);
+  noteChange(0);
+  trim();
+  return *this;
+}
+
+template<typename _Word> BasicBitset<_Word> operator<< (BasicBitset<_Word> &&l, size_t k) {
+  BasicBitset<_Word> o(move(l));
+  o <<= k;
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> operator<< (const BasicBitset<_Word> &l, size_t k) {
+  size_t size = l.b.size();
+  if (size == 0) {
+    return BasicBitset<_Word>();
+  }
+  size_t wordShift = k / BasicBitset<_Word>::bits;
+  size_t bitShift = k % BasicBitset<_Word>::bits;
+  size_t oSize = size + wordShift + (bitShift != 0);
+  BasicBitset<_Word> o(oSize, false);
+
+  const _Word *i = l.b.data();
+  fill(&o.b[0], &o.b[0] + wordShift, 0);
+  for (size_t j = wordShift; j != oSize; ++j) {
+    size_t srcI = j - wordShift;
+    _Word hi = srcI < size ? i[srcI] : 0;
+    if (bitShift == 0) {
+      o.b[j] = hi;
+    } else {
+      _Word lo = srcI != 0 ? i[srcI - 1] : 0;
+      o.b[j] = static_cast<_Word>(hi << bitShift) | static_cast<_Word>(lo >> (BasicBitset<_Word>::bits - bitShift));
+    }
+  }
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> operator>> (BasicBitset<_Word> &&l, size_t k) {
+  BasicBitset<_Word> o(move(l));
+  o >>= k;
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> operator>> (const BasicBitset<_Word> &l, size_t k) {
+  size_t size = l.b.size();
+  size_t wordShift = k / BasicBitset<_Word>::bits;
+  size_t bitShift = k % BasicBitset<_Word>::bits;
+  if (wordShift >= size) {
+    return BasicBitset<_Word>();
+  }
+  size_t oSize = size - wordShift;
+  BasicBitset<_Word> o(oSize, false);
+
+  const _Word *i = l.b.data() + wordShift;
+  for (size_t j = 0; j != oSize; ++j) {
+    if (bitShift == 0) {
+      o.b[j] = i[j];
+    } else {
+      _Word hi = j + 1 < oSize ? i[j + 1] : 0;
+      o.b[j] = static_cast<_Word>(i[j] >> bitShift) | static_cast<_Word>(hi << (BasicBitset<_Word>::bits - bitShift));
+    }
+  }
+  o.trim();
+  return o;
+}
+
+template<typename _Word> void BasicBitset<_Word>::assignOr (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+  const BasicBitset *i0 = &l;
+  size_t i0Size = lSize;
+  const BasicBitset *i1 = &r;
+  size_t i1Size = rSize;
+  if (lSize < rSize) {
+    i0 = &r;
+    i0Size = rSize;
+    i1 = &l;
+    i1Size = lSize;
+  }
+
+  // (If r_o is one of the operands, resizing it leaves its leading words intact.)
+  r_o.setSizeAny(i0Size);
+  BasicBitset::orOp(i0->b, i0Size, i1->b, i1Size, r_o.b);
+  r_o.noteChange(0);
+}
+
+template<typename _Word> void BasicBitset<_Word>::assignAnd (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r) {
+  size_t oSize = min(l.b.size(), r.b.size());
+
+  r_o.setSizeAny(oSize);
+  BasicBitset::andOp(l.b, r.b, oSize, r_o.b);
+  r_o.noteChange(0);
+  r_o.trim();
+}
+
+template<typename _Word> void BasicBitset<_Word>::assignAndNot (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+
+  r_o.setSizeAny(lSize);
+  BasicBitset::andNotOp(l.b, lSize, r.b, min(lSize, rSize), r_o.b);
+  r_o.noteChange(0);
+  r_o.trim();
+}
+
+template<typename _Word> bool BasicBitset<_Word>::equal (const word *l, size_t lSize, const word *r, size_t rSize) noexcept {
+  size_t oSize;
+  const word *b;
+  size_t bSize;
+  if (lSize > rSize) {
+    oSize = rSize;
+    b = l;
+    bSize = lSize;
+  } else {
+    oSize = lSize;
+    b = r;
+    bSize = rSize;
+  }
+
+  if (oSize != 0 && memcmp(l, r, oSize * sizeof(word)) != 0) {
+    return false;
+  }
+  return isZero(b + oSize, bSize - oSize);
+}
+
+template<typename _Word> bool BasicBitset<_Word>::operator== (const BasicBitset &r) const {
+  size_t size = getUsedSize();
+  return size == r.getUsedSize() && equal(b.data(), size, r.b.data(), size);
+}
+
+template<typename _Word> bool BasicBitset<_Word>::operator!= (const BasicBitset &r) const {
+  return !(*this == r);
+}
+
+template<typename _Word> int BasicBitset<_Word>::compare (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t size = l.getUsedSize();
+  size_t rSize = r.getUsedSize();
+  if (size != rSize) {
+    return size < rSize ? -1 : 1;
+  }
+
+  // Find the highest word that differs.
+  const word *lB = l.b.data();
+  const word *rB = r.b.data();
+  for (; size != 0; --size) {
+    word lW = lB[size - 1];
+    word rW = rB[size - 1];
+    if (lW != rW) {
+      return lW < rW ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::operator< (const BasicBitset &r) const noexcept {
+  return compare(*this, r) < 0;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::operator<= (const BasicBitset &r) const noexcept {
+  return compare(*this, r) <= 0;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::operator> (const BasicBitset &r) const noexcept {
+  return compare(*this, r) > 0;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::operator>= (const BasicBitset &r) const noexcept {
+  return compare(*this, r) >= 0;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::hash () const noexcept {
+  size_t cached = cachedHash.load(std::memory_order_relaxed);
+  if (cached != 0) {
+    return cached;
+  }
+
+  size_t h = hashBytes(b.data(), getUsedSize() * sizeof(word));
+  if (cachingHash) {
+    cachedHash.store(h, std::memory_order_relaxed);
+  }
+  return h;
+}
+
+template<typename _Word> void BasicBitset<_Word>::enableHashCache () noexcept {
+  cachingHash = true;
+}
+
+template<typename _Word> void BasicBitset<_Word>::disableHashCache () noexcept {
+  cachingHash = false;
+  cachedHash.store(0, std::memory_order_relaxed);
+}
+
+template<typename _Word> template<typename _ChunkOp> void BasicBitset<_Word>::forChunks (const Parallel &parallel, const word *base, size_t size, const _ChunkOp &chunkOp) {
+  // Place the chunk boundaries on cache line boundaries, so that no two threads write the same line.
+  static constexpr size_t lineSize = 64;
+  size_t skew = reinterpret_cast<std::uintptr_t>(base) % lineSize / sizeof(word);
+  size_t chunkCount = (size + skew + parallelChunkWords - 1) / parallelChunkWords;
+  parallel.pool.forEachChunk(chunkCount, [&] (size_t chunkI) {
+    size_t begin = chunkI == 0 ? 0 : chunkI * parallelChunkWords - skew;
+    size_t end = min(size, (chunkI + 1) * parallelChunkWords - skew);
+    chunkOp(begin, end);
+  });
+}
+
+template<typename _Word> template<typename _MergeOp, typename _RemainderOp> void BasicBitset<_Word>::op (
+  const Parallel &parallel, const word *i0, size_t i0Size, const word *i1, size_t i1Size,
+  word *r_o, Kernel kernel, _MergeOp mergeOp, _RemainderOp remainderOp
+) {
+  DPRE(i0Size >= i1Size);
+  forChunks(parallel, r_o, i0Size, [&] (size_t begin, size_t end) {
+    size_t mergeEnd = min(end, max(begin, i1Size));
+    op(i0 + begin, i1 + begin, mergeEnd - begin, r_o + begin, kernel, mergeOp);
+    for (size_t i = mergeEnd; i != end; ++i) {
+      r_o[i] = remainderOp(i0[i]);
+    }
+  });
+}
+
+template<typename _Word> void BasicBitset<_Word>::assignOr (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r, const Parallel &parallel) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+  if (max(lSize, rSize) * sizeof(word) < parallel.minBytes) {
+    assignOr(r_o, l, r);
+    return;
+  }
+  const BasicBitset *i0 = &l;
+  size_t i0Size = lSize;
+  const BasicBitset *i1 = &r;
+  size_t i1Size = rSize;
+  if (lSize < rSize) {
+    i0 = &r;
+    i0Size = rSize;
+    i1 = &l;
+    i1Size = lSize;
+  }
+
+  r_o.setSizeAny(i0Size);
+  op(parallel, i0->b.data(), i0Size, i1->b.data(), i1Size, r_o.b.data(), getKernels().orKernel, [] (word v0, word v1) -> word {
+    return v0 | v1;
+  }, [] (word o) -> word {
+    return o;
+  });
+  r_o.noteChange(0);
+}
+
+template<typename _Word> void BasicBitset<_Word>::assignAnd (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r, const Parallel &parallel) {
+  size_t oSize = min(l.b.size(), r.b.size());
+  if (oSize * sizeof(word) < parallel.minBytes) {
+    assignAnd(r_o, l, r);
+    return;
+  }
+
+  r_o.setSizeAny(oSize);
+  op(parallel, l.b.data(), oSize, r.b.data(), oSize, r_o.b.data(), getKernels().andKernel, [] (word v0, word v1) -> word {
+    return v0 & v1;
+  }, [] (word o) -> word {
+    return o;
+  });
+  r_o.noteChange(0);
+  r_o.trim();
+}
+
+template<typename _Word> void BasicBitset<_Word>::assignAndNot (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r, const Parallel &parallel) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+  if (lSize * sizeof(word) < parallel.minBytes) {
+    assignAndNot(r_o, l, r);
+    return;
+  }
+
+  r_o.setSizeAny(lSize);
+  op(parallel, l.b.data(), lSize, r.b.data(), min(lSize, rSize), r_o.b.data(), getKernels().andNotKernel, [] (word v0, word v1) -> word {
+    return v0 & ~v1;
+  }, [] (word o) -> word {
+    return o;
+  });
+  r_o.noteChange(0);
+  r_o.trim();
+}
+
+template<typename _Word> bool BasicBitset<_Word>::empty (const Parallel &parallel) const {
+  size_t size = b.size();
+  if (size * sizeof(word) < parallel.minBytes) {
+    return empty();
+  }
+
+  std::atomic<bool> nonZero(false);
+  forChunks(parallel, b.data(), size, [&] (size_t begin, size_t end) {
+    if (!nonZero.load(std::memory_order_relaxed) && !isZero(b.data() + begin, end - begin)) {
+      nonZero.store(true, std::memory_order_relaxed);
+    }
+  });
+  return !nonZero.load(std::memory_order_relaxed);
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::count (const Parallel &parallel) const {
+  size_t size = b.size();
+  if (size * sizeof(word) < parallel.minBytes) {
+    return count();
+  }
+
+  std::atomic<size_t> total(0);
+  forChunks(parallel, b.data(), size, [&] (size_t begin, size_t end) {
+    total.fetch_add(countBits(b.data() + begin, end - begin), std::memory_order_relaxed);
+  });
+  return total.load(std::memory_order_relaxed);
+}
+
+template<typename _Word> bool BasicBitset<_Word>::equal (const BasicBitset &l, const BasicBitset &r, const Parallel &parallel) {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+  size_t size = max(lSize, rSize);
+  if (size * sizeof(word) < parallel.minBytes) {
+    return l == r;
+  }
+  size_t commonSize = min(lSize, rSize);
+  const word *longer = (lSize < rSize ? r : l).b.data();
+
+  std::atomic<bool> differs(false);
+  forChunks(parallel, l.b.data(), size, [&] (size_t begin, size_t end) {
+    if (differs.load(std::memory_order_relaxed)) {
+      return;
+    }
+    size_t commonEnd = min(end, max(begin, commonSize));
+    if (
+      (commonEnd != begin && memcmp(l.b.data() + begin, r.b.data() + begin, (commonEnd - begin) * sizeof(word)) != 0) ||
+      !isZero(longer + commonEnd, end - commonEnd)
+    ) {
+      differs.store(true, std::memory_order_relaxed);
+    }
+  });
+  return !differs.load(std::memory_order_relaxed);
+}
+
+template<typename _Word> template<typename _MergeOp, typename _BlockOp> bool BasicBitset<_Word>::forMergedBlocks (
+  const word *i0, const word *i1, size_t size, Kernel kernel, _MergeOp mergeOp, const _BlockOp &blockOp
+) noexcept {
+  word block[scratchWords];
+  for (size_t begin = 0; begin < size; begin += scratchWords) {
+    size_t blockSize = min(scratchWords, size - begin);
+    op(i0 + begin, i1 + begin, blockSize, block, kernel, mergeOp);
+    if (!blockOp(block, blockSize)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename _Word> bool BasicBitset<_Word>::intersects (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t size = min(l.b.size(), r.b.size());
+  return !forMergedBlocks(l.b.data(), r.b.data(), size, getKernels().andKernel, [] (word v0, word v1) -> word {
+    return v0 & v1;
+  }, [] (const word *block, size_t blockSize) -> bool {
+    return isZero(block, blockSize);
+  });
+}
+
+template<typename _Word> bool BasicBitset<_Word>::isDisjoint (const BasicBitset &l, const BasicBitset &r) noexcept {
+  return !intersects(l, r);
+}
+
+template<typename _Word> bool BasicBitset<_Word>::isSubsetOf (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t lSize = l.b.size();
+  size_t size = min(lSize, r.b.size());
+  return isZero(l.b.data() + size, lSize - size) && forMergedBlocks(l.b.data(), r.b.data(), size, getKernels().andNotKernel, [] (word v0, word v1) -> word {
+    return v0 & ~v1;
+  }, [] (const word *block, size_t blockSize) -> bool {
+    return isZero(block, blockSize);
+  });
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::andCount (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t size = min(l.b.size(), r.b.size());
+  size_t count = 0;
+  forMergedBlocks(l.b.data(), r.b.data(), size, getKernels().andKernel, [] (word v0, word v1) -> word {
+    return v0 & v1;
+  }, [&] (const word *block, size_t blockSize) -> bool {
+    count += countBits(block, blockSize);
+    return true;
+  });
+  return count;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::orCount (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t lSize = l.b.size();
+  size_t rSize = r.b.size();
+  size_t size = min(lSize, rSize);
+  const BasicBitset &longer = lSize < rSize ? r : l;
+  size_t count = countBits(longer.b.data() + size, longer.b.size() - size);
+  forMergedBlocks(l.b.data(), r.b.data(), size, getKernels().orKernel, [] (word v0, word v1) -> word {
+    return v0 | v1;
+  }, [&] (const word *block, size_t blockSize) -> bool {
+    count += countBits(block, blockSize);
+    return true;
+  });
+  return count;
+}
+
+template<typename _Word> size_t BasicBitset<_Word>::andNotCount (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t lSize = l.b.size();
+  size_t size = min(lSize, r.b.size());
+  size_t count = countBits(l.b.data() + size, lSize - size);
+  forMergedBlocks(l.b.data(), r.b.data(), size, getKernels().andNotKernel, [] (word v0, word v1) -> word {
+    return v0 & ~v1;
+  }, [&] (const word *block, size_t blockSize) -> bool {
+    count += countBits(block, blockSize);
+    return true;
+  });
+  return count;
+}
+
+template<typename _Word> double BasicBitset<_Word>::jaccard (const BasicBitset &l, const BasicBitset &r) noexcept {
+  size_t orCount = BasicBitset::orCount(l, r);
+  return orCount == 0 ? 1 : static_cast<double>(andCount(l, r)) / static_cast<double>(orCount);
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::orAllImpl (const BasicBitset *const *bitsets, size_t count) {
+  size_t oSize = 0;
+  for (size_t j = 0; j != count; ++j) {
+    oSize = max(oSize, bitsets[j]->b.size());
+  }
+  BasicBitset o(oSize, false);
+
+  // Build the result a block at a time, so that it stays in cache while each of the inputs is merged into it.
+  Kernel kernel = getKernels().orKernel;
+  for (size_t begin = 0; begin < oSize; begin += blockWords) {
+    size_t end = min(begin + blockWords, oSize);
+    word *oBlock = &o.b[begin];
+    fill(oBlock, oBlock + (end - begin), 0);
+    for (size_t j = 0; j != count; ++j) {
+      const Words &i = bitsets[j]->b;
+      if (i.size() > begin) {
+        op(oBlock, i.data() + begin, min(end, i.size()) - begin, oBlock, kernel, [] (word v0, word v1) -> word {
+          return v0 | v1;
+        });
+      }
+    }
+  }
+
+  return o;
+}
+
+template<typename _Word> BasicBitset<_Word> BasicBitset<_Word>::andAllImpl (const BasicBitset *const *bitsets, size_t count) {
+  if (count == 0) {
+    return BasicBitset();
+  }
+  size_t oSize = bitsets[0]->b.size();
+  for (size_t j = 1; j != count; ++j) {
+    oSize = min(oSize, bitsets[j]->b.size());
+  }
+  BasicBitset o(oSize, false);
+
+  Kernel kernel = getKernels().andKernel;
+  for (size_t begin = 0; begin < oSize; begin += blockWords) {
+    size_t end = min(begin + blockWords, oSize);
+    word *oBlock = &o.b[begin];
+    const word *i = bitsets[0]->b.data() + begin;
+    copy(i, i + (end - begin), oBlock);
+    for (size_t j = 1; j != count && !isZero(oBlock, end - begin); ++j) {
+      op(oBlock, bitsets[j]->b.data() + begin, end - begin, oBlock, kernel, [] (word v0, word v1) -> word {
+        return v0 & v1;
+      });
+    }
+  }
+  o.trim();
+
+  return o;
+}
+
+#define BITSET_INSTANTIATE(_Word) \
+  template class BasicBitset<_Word>; \
+  template BasicBitset<_Word> operator| (BasicBitset<_Word> &&l, BasicBitset<_Word> &&r); \
+  template BasicBitset<_Word> operator| (BasicBitset<_Word> &&l, const BasicBitset<_Word> &r); \
+  template BasicBitset<_Word> operator| (const BasicBitset<_Word> &l, BasicBitset<_Word> &&r); \
+  template BasicBitset<_Word> operator| (const BasicBitset<_Word> &l, const BasicBitset<_Word> &r); \
+  template BasicBitset<_Word> operator& (BasicBitset<_Word> &&l, BasicBitset<_Word> &&r); \
+  template BasicBitset<_Word> operator& (BasicBitset<_Word> &&l, const BasicBitset<_Word> &r); \
+  template BasicBitset<_Word> operator& (const BasicBitset<_Word> &l, BasicBitset<_Word> &&r); \
+  template BasicBitset<_Word> operator& (const BasicBitset<_Word> &l, const BasicBitset<_Word> &r); \
+  template BasicBitset<_Word> operator^ (BasicBitset<_Word> &&l, BasicBitset<_Word> &&r); \
+  template BasicBitset<_Word> operator^ (BasicBitset<_Word> &&l, const BasicBitset<_Word> &r); \
+  template BasicBitset<_Word> operator^ (const BasicBitset<_Word> &l, BasicBitset<_Word> &&r); \
+  template BasicBitset<_Word> operator^ (const BasicBitset<_Word> &l, const BasicBitset<_Word> &r); \
+  template BasicBitset<_Word> operator<< (BasicBitset<_Word> &&l, size_t k); \
+  template BasicBitset<_Word> operator<< (const BasicBitset<_Word> &l, size_t k); \
+  template BasicBitset<_Word> operator>> (BasicBitset<_Word> &&l, size_t k); \
+  template BasicBitset<_Word> operator>> (const BasicBitset<_Word> &l, size_t k);
+
+BITSET_INSTANTIATE(iu32)
+BITSET_INSTANTIATE(iu64)
+#ifdef __SIZEOF_INT128__
+BITSET_INSTANTIATE(iu128)
+#endif
+
+#undef BITSET_INSTANTIATE
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+constexpr size_t CompressedBitset::nonIndex;
+constexpr size_t CompressedBitset::maxIndex;
+constexpr size_t CompressedBitset::chunkBits;
+constexpr size_t CompressedBitset::bitmapWords;
+constexpr size_t CompressedBitset::maxArraySize;
+
+namespace {
+
+void setBitmapRange (vector<iu64> &r_bitmap, size_t begin, size_t end) noexcept {
+  for (; begin != end && begin % 64 != 0; ++begin) {
+    r_bitmap[begin / 64] |= static_cast<iu64>(1) << (begin % 64);
+  }
+  for (; end - begin >= 64; begin += 64) {
+    r_bitmap[begin / 64] = ~static_cast<iu64>(0);
+  }
+  for (; begin != end; ++begin) {
+    r_bitmap[begin / 64] |= static_cast<iu64>(1) << (begin % 64);
+  }
+}
+
+size_t getNextBitmapBit (const vector<iu64> &bitmap, size_t i, bool set) noexcept {
+  size_t wordI = i / 64;
+  size_t end = bitmap.size();
+  if (wordI == end) {
+    return end * 64;
+  }
+
+  iu64 w = (set ? bitmap[wordI] : ~bitmap[wordI]) >> (i % 64);
+  if (w != 0) {
+    return i + getLowestSetBit(w);
+  }
+  for (++wordI; wordI != end; ++wordI) {
+    w = set ? bitmap[wordI] : ~bitmap[wordI];
+    if (w != 0) {
+      return wordI * 64 + getLowestSetBit(w);
+    }
+  }
+  return end * 64;
+}
+
+size_t getBitmapRunCount (const vector<iu64> &bitmap) noexcept {
+  size_t count = 0;
+  iu64 carry = 0;
+  for (iu64 w : bitmap) {
+    count += getSetBitCount(w & ~((w << 1) | carry));
+    carry = w >> 63;
+  }
+  return count;
+}
+
+}
+
+bool CompressedBitset::Container::get (iu16 i) const noexcept {
+  switch (type) {
+    case Type::ARRAY:
+      return binary_search(values.begin(), values.end(), i);
+    case Type::BITMAP:
+      return (bitmap[i / 64] >> (i % 64)) & 0b1;
+    default: {
+      size_t runI = findRun(i);
+      return runI != values.size() && values[runI] <= i;
+    }
+  }
+}
+
+void CompressedBitset::Container::set (iu16 i) {
+  switch (type) {
+    case Type::ARRAY: {
+      auto it = lower_bound(values.begin(), values.end(), i);
+      if (it != values.end() && *it == i) {
+        return;
+      }
+      if (values.size() != maxArraySize) {
+        values.insert(it, i);
+        return;
+      }
+
+      vector<iu64> b;
+      getBitmap(b);
+      setBitmap(move(b));
+      // fall through
+    }
+    case Type::BITMAP: {
+      iu64 &w = bitmap[i / 64];
+      iu64 mask = static_cast<iu64>(1) << (i % 64);
+      if ((w & mask) == 0) {
+        w |= mask;
+        ++cardinality;
+      }
+      return;
+    }
+    default: {
+      size_t runI = findRun(i);
+      if (runI != values.size() && values[runI] <= i) {
+        return;
+      }
+
+      bool joinsPrev = runI != 0 && values[runI - 1] + 1 == i;
+      bool joinsNext = runI != values.size() && values[runI] == i + 1;
+      if (joinsPrev && joinsNext) {
+        values.erase(values.begin() + static_cast<ptrdiff_t>(runI - 1), values.begin() + static_cast<ptrdiff_t>(runI + 1));
+      } else if (joinsPrev) {
+        values[runI - 1] = i;
+      } else if (joinsNext) {
+        values[runI] = i;
+      } else {
+        values.insert(values.begin() + static_cast<ptrdiff_t>(runI), {i, i});
+        if (values.size() * sizeof(iu16) > bitmapWords * sizeof(iu64)) {
+          vector<iu64> b;
+          getBitmap(b);
+          setBitmap(move(b));
+        }
+      }
+      return;
+    }
+  }
+}
+
+void CompressedBitset::Container::clear (iu16 i) {
+  switch (type) {
+    case Type::ARRAY: {
+      auto it = lower_bound(values.begin(), values.end(), i);
+      if (it != values.end() && *it == i) {
+        values.erase(it);
+      }
+      return;
+    }
+    case Type::BITMAP: {
+      iu64 &w = bitmap[i / 64];
+      iu64 mask = static_cast<iu64>(1) << (i % 64);
+      if ((w & mask) != 0) {
+        w &= ~mask;
+        if (--cardinality <= maxArraySize) {
+          compact();
+        }
+      }
+      return;
+    }
+    default: {
+      size_t runI = findRun(i);
+      if (runI == values.size() || values[runI] > i) {
+        return;
+      }
+
+      iu16 first = values[runI];
+      iu16 last = values[runI + 1];
+      if (first == last) {
+        values.erase(values.begin() + static_cast<ptrdiff_t>(runI), values.begin() + static_cast<ptrdiff_t>(runI + 2));
+      } else if (i == first) {
+        values[runI] = i + 1;
+      } else if (i == last) {
+        values[runI + 1] = i - 1;
+      } else {
+        values[runI + 1] = i - 1;
+        values.insert(values.begin() + static_cast<ptrdiff_t>(runI + 2), {static_cast<iu16>(i + 1), last});
+        if (values.size() * sizeof(iu16) > bitmapWords * sizeof(iu64)) {
+          vector<iu64> b;
+          getBitmap(b);
+          setBitmap(move(b));
+        }
+      }
+      return;
+    }
+  }
+}
+
+size_t CompressedBitset::Container::getNext (size_t i) const noexcept {
+  DPRE(i < chunkBits);
+  switch (type) {
+    case Type::ARRAY: {
+      auto it = lower_bound(values.begin(), values.end(), i);
+      return it == values.end() ? chunkBits : *it;
+    }
+    case Type::BITMAP:
+      return getNextBitmapBit(bitmap, i, true);
+    default: {
+      size_t runI = findRun(static_cast<iu16>(i));
+      return runI == values.size() ? chunkBits : max(i, static_cast<size_t>(values[runI]));
+    }
+  }
+}
+
+iu16 CompressedBitset::Container::getLast () const noexcept {
+  DPRE(!empty());
+  if (type != Type::BITMAP) {
+    return values.back();
+  }
+
+  size_t wordI = bitmapWords - 1;
+  for (; bitmap[wordI] == 0; --wordI) {
+  }
+  return static_cast<iu16>(wordI * 64 + BasicBitset<iu64>::getHighestSetBit(bitmap[wordI]));
+}
+
+size_t CompressedBitset::Container::count () const noexcept {
+  switch (type) {
+    case Type::ARRAY:
+      return values.size();
+    case Type::BITMAP:
+      return cardinality;
+    default: {
+      size_t count = 0;
+      for (size_t i = 0, end = values.size(); i != end; i += 2) {
+        count += static_cast<size_t>(values[i + 1] - values[i]) + 1;
+      }
+      return count;
+    }
+  }
+}
+
+bool CompressedBitset::Container::empty () const noexcept {
+  return type == Type::BITMAP ? cardinality == 0 : values.empty();
+}
+
+size_t CompressedBitset::Container::findRun (iu16 i) const noexcept {
+  DPRE(type == Type::RUN);
+  // Find the first run that ends at or after i.
+  size_t begin = 0;
+  size_t end = values.size() / 2;
+  while (begin != end) {
+    size_t mid = begin + (end - begin) / 2;
+    if (values[mid * 2 + 1] < i) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin * 2;
+}
+
+void CompressedBitset::Container::getBitmap (vector<iu64> &r_bitmap) const {
+  switch (type) {
+    case Type::ARRAY:
+      r_bitmap.assign(bitmapWords, 0);
+      for (iu16 v : values) {
+        r_bitmap[v / 64] |= static_cast<iu64>(1) << (v % 64);
+      }
+      break;
+    case Type::BITMAP:
+      r_bitmap = bitmap;
+      break;
+    default:
+      r_bitmap.assign(bitmapWords, 0);
+      for (size_t i = 0, end = values.size(); i != end; i += 2) {
+        setBitmapRange(r_bitmap, values[i], static_cast<size_t>(values[i + 1]) + 1);
+      }
+      break;
+  }
+}
+
+void CompressedBitset::Container::setBitmap (vector<iu64> &&bitmap) {
+  DPRE(bitmap.size() == bitmapWords);
+  type = Type::BITMAP;
+  this->bitmap = move(bitmap);
+  values = vector<iu16>();
+  cardinality = 0;
+  for (iu64 w : this->bitmap) {
+    cardinality += getSetBitCount(w);
+  }
+}
+
+void CompressedBitset::Container::compact () {
+  size_t count = this->count();
+  size_t runCount;
+  switch (type) {
+    case Type::ARRAY:
+      runCount = 0;
+      for (size_t i = 0, end = values.size(); i != end; ++i) {
+        if (i == 0 || values[i - 1] + 1 != values[i]) {
+          ++runCount;
+        }
+      }
+      break;
+    case Type::BITMAP:
+      runCount = getBitmapRunCount(bitmap);
+      break;
+    default:
+      runCount = values.size() / 2;
+      break;
+  }
+
+  Type newType;
+  if (runCount * 2 * sizeof(iu16) < min(count * sizeof(iu16), bitmapWords * sizeof(iu64))) {
+    newType = Type::RUN;
+  } else if (count <= maxArraySize) {
+    newType = Type::ARRAY;
   } else {
-    Bitset o(move(r));
-    size_t oSize;
-    if (rSize < lSize) {
-      o.b.append_any(lSize - rSize);
-      oSize = rSize;
+    newType = Type::BITMAP;
+  }
+
+  if (newType != type) {
+    vector<iu64> b;
+    getBitmap(b);
+    if (newType == Type::BITMAP) {
+      setBitmap(move(b));
+    } else {
+      type = newType;
+      bitmap = vector<iu64>();
+      cardinality = 0;
+      values.clear();
+      values.reserve(newType == Type::ARRAY ? count : runCount * 2);
+      for (size_t i = getNextBitmapBit(b, 0, true); i != chunkBits; ) {
+        if (newType == Type::ARRAY) {
+          values.push_back(static_cast<iu16>(i));
+          i = getNextBitmapBit(b, i + 1, true);
+        } else {
+          size_t end = getNextBitmapBit(b, i, false);
+          values.push_back(static_cast<iu16>(i));
+          values.push_back(static_cast<iu16>(end - 1));
+          i = end == chunkBits ? chunkBits : getNextBitmapBit(b, end, true);
+        }
+      }
+    }
+  }
+  values.shrink_to_fit();
+}
+
+CompressedBitset::Container CompressedBitset::Container::orOp (const Container &c0, const Container &c1) {
+  Container o;
+  if (c0.type == Type::ARRAY && c1.type == Type::ARRAY && c0.values.size() + c1.values.size() <= maxArraySize) {
+    o.values.reserve(c0.values.size() + c1.values.size());
+    set_union(c0.values.begin(), c0.values.end(), c1.values.begin(), c1.values.end(), back_inserter(o.values));
+  } else {
+    vector<iu64> b0;
+    c0.getBitmap(b0);
+    if (c1.type == Type::ARRAY) {
+      for (iu16 v : c1.values) {
+        b0[v / 64] |= static_cast<iu64>(1) << (v % 64);
+      }
+    } else if (c1.type == Type::BITMAP) {
+      for (size_t i = 0; i != bitmapWords; ++i) {
+        b0[i] |= c1.bitmap[i];
+      }
+    } else {
+      for (size_t i = 0, end = c1.values.size(); i != end; i += 2) {
+        setBitmapRange(b0, c1.values[i], static_cast<size_t>(c1.values[i + 1]) + 1);
+      }
+    }
+    o.setBitmap(move(b0));
+  }
+  o.compact();
+  return o;
+}
+
+CompressedBitset::Container CompressedBitset::Container::andOp (const Container &c0, const Container &c1) {
+  Container o;
+  if (c0.type == Type::ARRAY && c1.type == Type::ARRAY) {
+    set_intersection(c0.values.begin(), c0.values.end(), c1.values.begin(), c1.values.end(), back_inserter(o.values));
+  } else if (c0.type == Type::ARRAY || c1.type == Type::ARRAY) {
+    const Container &a = c0.type == Type::ARRAY ? c0 : c1;
+    const Container &other = c0.type == Type::ARRAY ? c1 : c0;
+    for (iu16 v : a.values) {
+      if (other.get(v)) {
+        o.values.push_back(v);
+      }
+    }
+  } else {
+    vector<iu64> b0;
+    vector<iu64> b1;
+    c0.getBitmap(b0);
+    c1.getBitmap(b1);
+    for (size_t i = 0; i != bitmapWords; ++i) {
+      b0[i] &= b1[i];
+    }
+    o.setBitmap(move(b0));
+  }
+  o.compact();
+  return o;
+}
+
+CompressedBitset::Container CompressedBitset::Container::andNotOp (const Container &c0, const Container &c1) {
+  Container o;
+  if (c0.type == Type::ARRAY && c1.type == Type::ARRAY) {
+    set_difference(c0.values.begin(), c0.values.end(), c1.values.begin(), c1.values.end(), back_inserter(o.values));
+  } else if (c0.type == Type::ARRAY) {
+    for (iu16 v : c0.values) {
+      if (!c1.get(v)) {
+        o.values.push_back(v);
+      }
+    }
+  } else {
+    vector<iu64> b0;
+    c0.getBitmap(b0);
+    if (c1.type == Type::ARRAY) {
+      for (iu16 v : c1.values) {
+        b0[v / 64] &= ~(static_cast<iu64>(1) << (v % 64));
+      }
+    } else {
+      vector<iu64> b1;
+      c1.getBitmap(b1);
+      for (size_t i = 0; i != bitmapWords; ++i) {
+        b0[i] &= ~b1[i];
+      }
+    }
+    o.setBitmap(move(b0));
+  }
+  o.compact();
+  return o;
+}
+
+bool CompressedBitset::Container::operator== (const Container &r) const {
+  if (type == r.type) {
+    return type == Type::BITMAP ? bitmap == r.bitmap : values == r.values;
+  }
+  if (count() != r.count()) {
+    return false;
+  }
+
+  vector<iu64> b0;
+  vector<iu64> b1;
+  getBitmap(b0);
+  r.getBitmap(b1);
+  return b0 == b1;
+}
+
+CompressedBitset::CompressedBitset () {
+}
+
+CompressedBitset::CompressedBitset (const Bitset &o) {
+  static constexpr size_t chunkWords = chunkBits / Bitset::bits;
+  const Bitset::word *b = o.b.data();
+  size_t bSize = o.b.size();
+
+  vector<iu64> bitmap;
+  for (size_t begin = 0; begin < bSize; begin += chunkWords) {
+    size_t end = min(begin + chunkWords, bSize);
+    if (Bitset::isZero(b + begin, end - begin)) {
+      continue;
+    }
+    DPRE(begin / chunkWords <= maxIndex / chunkBits, "o must have no bits set beyond maxIndex");
+
+    bitmap.assign(bitmapWords, 0);
+    for (size_t i = begin; i != end; ++i) {
+      size_t bitI = (i - begin) * Bitset::bits;
+      bitmap[bitI / 64] |= static_cast<iu64>(b[i]) << (bitI % 64);
+    }
+    Container c;
+    c.setBitmap(move(bitmap));
+    c.compact();
+    keys.push_back(static_cast<iu16>(begin / chunkWords));
+    containers.push_back(move(c));
+  }
+}
+
+Bitset CompressedBitset::toBitset () const {
+  Bitset o;
+  if (keys.empty()) {
+    return o;
+  }
+  o.ensureWidth(keys.back() * chunkBits + containers.back().getLast() + 1);
+
+  vector<iu64> scratch;
+  for (size_t c = 0, end = keys.size(); c != end; ++c) {
+    size_t base = keys[c] * chunkBits;
+    const Container &container = containers[c];
+    if (container.type == Container::Type::ARRAY) {
+      for (iu16 v : container.values) {
+        o.setExistingBit(base + v);
+      }
+      continue;
+    }
+
+    const vector<iu64> *bitmap = &container.bitmap;
+    if (container.type == Container::Type::RUN) {
+      container.getBitmap(scratch);
+      bitmap = &scratch;
+    }
+    for (size_t i = 0; i != bitmapWords; ++i) {
+      iu64 w = (*bitmap)[i];
+      if (w == 0) {
+        continue;
+      }
+      for (size_t shift = 0; shift < 64; shift += Bitset::bits) {
+        size_t wordI = (base + i * 64 + shift) / Bitset::bits;
+        if (o.wordIsWithinWidth(wordI)) {
+          o.b[wordI] |= static_cast<Bitset::word>(w >> shift);
+        }
+      }
+    }
+  }
+  return o;
+}
+
+size_t CompressedBitset::findContainer (iu16 key) const noexcept {
+  return static_cast<size_t>(lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+}
+
+void CompressedBitset::setBit (size_t i) {
+  DPRE(i <= maxIndex);
+  iu16 key = static_cast<iu16>(i / chunkBits);
+
+  size_t c = findContainer(key);
+  if (c == keys.size() || keys[c] != key) {
+    keys.insert(keys.begin() + static_cast<ptrdiff_t>(c), key);
+    containers.emplace(containers.begin() + static_cast<ptrdiff_t>(c));
+  }
+  containers[c].set(static_cast<iu16>(i % chunkBits));
+}
+
+void CompressedBitset::clearBit (size_t i) {
+  if (i > maxIndex) {
+    return;
+  }
+  iu16 key = static_cast<iu16>(i / chunkBits);
+
+  size_t c = findContainer(key);
+  if (c == keys.size() || keys[c] != key) {
+    return;
+  }
+  containers[c].clear(static_cast<iu16>(i % chunkBits));
+  if (containers[c].empty()) {
+    keys.erase(keys.begin() + static_cast<ptrdiff_t>(c));
+    containers.erase(containers.begin() + static_cast<ptrdiff_t>(c));
+  }
+}
+
+bool CompressedBitset::getBit (size_t i) const noexcept {
+  if (i > maxIndex) {
+    return false;
+  }
+  iu16 key = static_cast<iu16>(i / chunkBits);
+
+  size_t c = findContainer(key);
+  return c != keys.size() && keys[c] == key && containers[c].get(static_cast<iu16>(i % chunkBits));
+}
+
+size_t CompressedBitset::getNextSetBit (size_t i) const noexcept {
+  if (i > maxIndex) {
+    return nonIndex;
+  }
+  iu16 key = static_cast<iu16>(i / chunkBits);
+
+  size_t low = i % chunkBits;
+  for (size_t c = findContainer(key), end = keys.size(); c != end; ++c) {
+    if (keys[c] != key) {
+      low = 0;
+    }
+    size_t next = containers[c].getNext(low);
+    if (next != chunkBits) {
+      return keys[c] * chunkBits + next;
+    }
+  }
+  return nonIndex;
+}
+
+void CompressedBitset::clear () noexcept {
+  keys.clear();
+  containers.clear();
+}
+
+bool CompressedBitset::empty () const noexcept {
+  return keys.empty();
+}
+
+size_t CompressedBitset::count () const noexcept {
+  size_t count = 0;
+  for (const Container &c : containers) {
+    count += c.count();
+  }
+  return count;
+}
+
+void CompressedBitset::compact () {
+  for (Container &c : containers) {
+    c.compact();
+  }
+  keys.shrink_to_fit();
+  containers.shrink_to_fit();
+}
+
+template<typename _ContainerOp> CompressedBitset CompressedBitset::op (
+  const CompressedBitset &l, const CompressedBitset &r, bool keepL, bool keepR, _ContainerOp containerOp
+) {
+  CompressedBitset o;
+  size_t lI = 0;
+  size_t lEnd = l.keys.size();
+  size_t rI = 0;
+  size_t rEnd = r.keys.size();
+  while (lI != lEnd || rI != rEnd) {
+    if (rI == rEnd || (lI != lEnd && l.keys[lI] < r.keys[rI])) {
+      if (keepL) {
+        o.keys.push_back(l.keys[lI]);
+        o.containers.push_back(l.containers[lI]);
+      }
+      ++lI;
+    } else if (lI == lEnd || r.keys[rI] < l.keys[lI]) {
+      if (keepR) {
+        o.keys.push_back(r.keys[rI]);
+        o.containers.push_back(r.containers[rI]);
+      }
+      ++rI;
+    } else {
+      Container c = containerOp(l.containers[lI], r.containers[rI]);
+      if (!c.empty()) {
+        o.keys.push_back(l.keys[lI]);
+        o.containers.push_back(move(c));
+      }
+      ++lI;
+      ++rI;
+    }
+  }
+  return o;
+}
+
+CompressedBitset &CompressedBitset::operator|= (const CompressedBitset &r) {
+  *this = *this | r;
+  return *this;
+}
+
+CompressedBitset operator| (const CompressedBitset &l, const CompressedBitset &r) {
+  return CompressedBitset::op(l, r, true, true, CompressedBitset::Container::orOp);
+}
+
+CompressedBitset &CompressedBitset::operator&= (const CompressedBitset &r) {
+  *this = *this & r;
+  return *this;
+}
+
+CompressedBitset operator& (const CompressedBitset &l, const CompressedBitset &r) {
+  return CompressedBitset::op(l, r, false, false, CompressedBitset::Container::andOp);
+}
+
+CompressedBitset &CompressedBitset::andNot (const CompressedBitset &r) {
+  *this = andNot(*this, r);
+  return *this;
+}
+
+CompressedBitset CompressedBitset::andNot (const CompressedBitset &l, const CompressedBitset &r) {
+  return op(l, r, true, false, Container::andNotOp);
+}
+
+bool CompressedBitset::operator== (const CompressedBitset &r) const {
+  return keys == r.keys && containers == r.containers;
+}
+
+bool CompressedBitset::operator!= (const CompressedBitset &r) const {
+  return !(*this == r);
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+constexpr size_t ConcurrentBitset::bits;
+constexpr ConcurrentBitset::word ConcurrentBitset::one;
+constexpr size_t ConcurrentBitset::firstSegmentWords;
+constexpr size_t ConcurrentBitset::maxSegmentCount;
+constexpr size_t ConcurrentBitset::nonIndex;
+
+ConcurrentBitset::ConcurrentBitset () noexcept : segmentCount(0) {
+  for (std::atomic<std::atomic<word> *> &segment : segments) {
+    segment.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+ConcurrentBitset::ConcurrentBitset (size_t width) : ConcurrentBitset() {
+  if (width != 0) {
+    size_t offset;
+    size_t lastSegmentI = getSegment((width - 1) / bits, offset);
+    for (size_t segmentI = 0; segmentI <= lastSegmentI; ++segmentI) {
+      getOrCreateWord(getSegmentBegin(segmentI));
+    }
+  }
+}
+
+ConcurrentBitset::~ConcurrentBitset () noexcept {
+  for (std::atomic<std::atomic<word> *> &segment : segments) {
+    delete[] segment.load(std::memory_order_relaxed);
+  }
+}
+
+size_t ConcurrentBitset::getSegment (size_t wordI, size_t &r_offset) noexcept {
+  size_t segmentI = Bitset::getHighestSetBit(static_cast<word>(wordI / firstSegmentWords + 1));
+  r_offset = wordI - getSegmentBegin(segmentI);
+  return segmentI;
+}
+
+size_t ConcurrentBitset::getSegmentBegin (size_t segmentI) noexcept {
+  return firstSegmentWords * ((static_cast<size_t>(1) << segmentI) - 1);
+}
+
+std::atomic<ConcurrentBitset::word> *ConcurrentBitset::getWord (size_t wordI) const noexcept {
+  size_t offset;
+  size_t segmentI = getSegment(wordI, offset);
+  std::atomic<word> *segment = segments[segmentI].load(std::memory_order_acquire);
+  return segment ? segment + offset : nullptr;
+}
+
+std::atomic<ConcurrentBitset::word> &ConcurrentBitset::getOrCreateWord (size_t wordI) {
+  size_t offset;
+  size_t segmentI = getSegment(wordI, offset);
+  std::atomic<word> *segment = segments[segmentI].load(std::memory_order_acquire);
+  if (!segment) {
+    // Race to install a new segment, discarding ours if another thread gets there first.
+    size_t size = firstSegmentWords << segmentI;
+    std::atomic<word> *newSegment = new std::atomic<word>[size];
+    for (size_t i = 0; i != size; ++i) {
+      newSegment[i].store(0, std::memory_order_relaxed);
+    }
+    if (segments[segmentI].compare_exchange_strong(segment, newSegment, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      segment = newSegment;
     } else {
-      oSize = lSize;
-      o.b.erase(oSize);
+      delete[] newSegment;
+    }
+  }
+
+  // Raise segmentCount on every path, not just when installing the segment: the thread that installed it may not
+  // have raised it yet, and our caller's scans (which stop at segmentCount) must see the bit it is about to set.
+  size_t count = segmentCount.load(std::memory_order_relaxed);
+  while (count < segmentI + 1 && !segmentCount.compare_exchange_weak(count, segmentI + 1, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+  return segment[offset];
+}
+
+void ConcurrentBitset::setBit (size_t i) {
+  getOrCreateWord(i / bits).fetch_or(one << (i % bits), std::memory_order_acq_rel);
+}
+
+void ConcurrentBitset::clearBit (size_t i) noexcept {
+  std::atomic<word> *w = getWord(i / bits);
+  if (w) {
+    w->fetch_and(~(one << (i % bits)), std::memory_order_acq_rel);
+  }
+}
+
+bool ConcurrentBitset::testAndSet (size_t i) {
+  word mask = one << (i % bits);
+  return (getOrCreateWord(i / bits).fetch_or(mask, std::memory_order_acq_rel) & mask) != 0;
+}
+
+bool ConcurrentBitset::testAndClear (size_t i) noexcept {
+  std::atomic<word> *w = getWord(i / bits);
+  word mask = one << (i % bits);
+  return w && (w->fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0;
+}
+
+bool ConcurrentBitset::getBit (size_t i) const noexcept {
+  std::atomic<word> *w = getWord(i / bits);
+  return w && ((w->load(std::memory_order_acquire) >> (i % bits)) & 0b1);
+}
+
+template<typename _ReadOp, typename _AbsentResult> size_t ConcurrentBitset::getNextBit (size_t i, const _ReadOp &readOp, const _AbsentResult &absentResult) const noexcept {
+  size_t wordI = i / bits;
+  size_t offset;
+  size_t segmentI = getSegment(wordI, offset);
+  size_t bitI = i % bits;
+  for (size_t end = segmentCount.load(std::memory_order_acquire); segmentI < end; ++segmentI, offset = 0, bitI = 0) {
+    size_t begin = getSegmentBegin(segmentI);
+    const std::atomic<word> *segment = segments[segmentI].load(std::memory_order_acquire);
+    if (!segment) {
+      size_t r = absentResult((begin + offset) * bits + bitI);
+      if (r != nonIndex) {
+        return r;
+      }
+      continue;
     }
 
-    Bitset::andNotOp(l.b, lSize, o.b, oSize, o.b);
+    for (size_t size = firstSegmentWords << segmentI; offset != size; ++offset, bitI = 0) {
+      word w = readOp(segment[offset].load(std::memory_order_acquire)) >> bitI;
+      if (w != 0) {
+        return (begin + offset) * bits + bitI + getLowestSetBit(w);
+      }
+    }
+  }
+  return absentResult(max(i, getSegmentBegin(segmentI) * bits));
+}
+
+size_t ConcurrentBitset::getNextSetBit (size_t i) const noexcept {
+  return getNextBit(i, [] (word w) -> word {
+    return w;
+  }, [] (size_t i) -> size_t {
+    return nonIndex;
+  });
+}
+
+size_t ConcurrentBitset::getNextClearBit (size_t i) const noexcept {
+  return getNextBit(i, [] (word w) -> word {
+    return ~w;
+  }, [] (size_t i) -> size_t {
+    return i;
+  });
+}
 
+Bitset ConcurrentBitset::toBitset () const {
+  Bitset o;
+  size_t end = segmentCount.load(std::memory_order_acquire);
+  if (end == 0) {
     return o;
   }
+  o.ensureWidthForWord(getSegmentBegin(end) - 1);
+
+  for (size_t segmentI = 0; segmentI != end; ++segmentI) {
+    const std::atomic<word> *segment = segments[segmentI].load(std::memory_order_acquire);
+    if (segment) {
+      word *b = &o.b[getSegmentBegin(segmentI)];
+      for (size_t i = 0, size = firstSegmentWords << segmentI; i != size; ++i) {
+        b[i] = segment[i].load(std::memory_order_acquire);
+      }
+    }
+  }
+  return o;
 }
 
-Bitset Bitset::andNot (const Bitset &l, const Bitset &r) {
-  size_t lSize = l.b.size();
-  size_t rSize = r.b.size();
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+constexpr size_t BitsetView::bits;
+constexpr size_t BitsetView::nonIndex;
 
-  size_t oSize = min(lSize, rSize);
-  Bitset o(lSize, false);
+BitsetView::BitsetView () noexcept : b(nullptr), wordCount(0) {
+}
+
+BitsetView::BitsetView (const word *b, size_t wordCount) noexcept : b(b), wordCount(wordCount) {
+  DPRE(b || wordCount == 0);
+  DPRE(reinterpret_cast<std::uintptr_t>(b) % alignof(word) == 0, "b must be aligned for word");
+}
 
-  Bitset::andNotOp(l.b, lSize, r.b, oSize, o.b);
+BitsetView::BitsetView (const Bitset &o) noexcept : b(o.b.data()), wordCount(o.b.size()) {
+}
 
+Bitset BitsetView::toBitset () const {
+  Bitset o(wordCount, false);
+  copy(b, b + wordCount, o.b.data());
   return o;
 }
 
-bool Bitset::operator== (const Bitset &r) const {
-  size_t lSize = b.size();
-  size_t rSize = r.b.size();
-  size_t oSize;
-  const string<word> *b;
-  if (lSize > rSize) {
-    oSize = rSize;
-    b = &this->b;
-  } else {
-    oSize = lSize;
-    b = &r.b;
+const BitsetView::word *BitsetView::getWords () const noexcept {
+  return b;
+}
+
+size_t BitsetView::getWordCount () const noexcept {
+  return wordCount;
+}
+
+bool BitsetView::getBit (size_t i) const noexcept {
+  size_t wordI = i / bits;
+  size_t bitI = i % bits;
+
+  return wordI < wordCount ? (b[wordI] >> bitI) & 0b1 : 0;
+}
+
+size_t BitsetView::getNextSetBit (size_t i) const noexcept {
+  return Bitset::getNextSetBit(b, wordCount, i);
+}
+
+size_t BitsetView::getNextClearBit (size_t i) const noexcept {
+  return Bitset::getNextClearBit(b, wordCount, i);
+}
+
+bool BitsetView::empty () const noexcept {
+  return Bitset::isZero(b, wordCount);
+}
+
+size_t BitsetView::count () const noexcept {
+  return Bitset::countBits(b, wordCount);
+}
+
+Bitset BitsetView::orOp (const BitsetView &l, const BitsetView &r) {
+  const BitsetView &i0 = l.wordCount < r.wordCount ? r : l;
+  const BitsetView &i1 = l.wordCount < r.wordCount ? l : r;
+  Bitset o(i0.wordCount, false);
+
+  word *out = o.b.data();
+  Bitset::op(i0.b, i1.b, i1.wordCount, out, getKernels().orKernel, [] (word v0, word v1) -> word {
+    return v0 | v1;
+  });
+  copy(i0.b + i1.wordCount, i0.b + i0.wordCount, out + i1.wordCount);
+  return o;
+}
+
+Bitset BitsetView::andOp (const BitsetView &l, const BitsetView &r) {
+  size_t oSize = min(l.wordCount, r.wordCount);
+  Bitset o(oSize, false);
+
+  Bitset::op(l.b, r.b, oSize, o.b.data(), getKernels().andKernel, [] (word v0, word v1) -> word {
+    return v0 & v1;
+  });
+  o.trim();
+  return o;
+}
+
+Bitset BitsetView::andNot (const BitsetView &l, const BitsetView &r) {
+  size_t iSize = min(l.wordCount, r.wordCount);
+  Bitset o(l.wordCount, false);
+
+  word *out = o.b.data();
+  Bitset::op(l.b, r.b, iSize, out, getKernels().andNotKernel, [] (word v0, word v1) -> word {
+    return v0 & ~v1;
+  });
+  copy(l.b + iSize, l.b + l.wordCount, out + iSize);
+  o.trim();
+  return o;
+}
+
+bool BitsetView::equal (const BitsetView &l, const BitsetView &r) noexcept {
+  return Bitset::equal(l.b, l.wordCount, r.b, r.wordCount);
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+constexpr iu32 BitsetFormat::magic;
+constexpr iu16 BitsetFormat::version;
+constexpr iu16 BitsetFormat::checksumFlag;
+constexpr size_t BitsetFormat::unitSize;
+constexpr size_t BitsetFormat::headerSize;
+constexpr size_t BitsetFormat::bufferSize;
+
+size_t BitsetFormat::getUnitCount (size_t wordCount) noexcept {
+  return (wordCount * sizeof(word) + unitSize - 1) / unitSize;
+}
+
+iu64 BitsetFormat::loadUnit (const iu8 *b) noexcept {
+  iu64 u = 0;
+  for (size_t i = unitSize; i != 0; --i) {
+    u = (u << 8) | b[i - 1];
+  }
+  return u;
+}
+
+void BitsetFormat::storeUnit (iu64 u, iu8 *r_o) noexcept {
+  for (size_t i = 0; i != unitSize; ++i) {
+    r_o[i] = static_cast<iu8>(u >> (i * 8));
+  }
+}
+
+bool BitsetFormat::parseHeader (const iu8 *b, iu64 &r_unitCount, bool &r_checksummed) noexcept {
+  iu64 u = loadUnit(b);
+  iu16 v = static_cast<iu16>(u >> 32);
+  iu16 flags = static_cast<iu16>(u >> 48);
+  if (static_cast<iu32>(u) != magic || v == 0 || v > version || (flags & ~checksumFlag) != 0) {
+    return false;
+  }
+
+  iu64 unitCount = loadUnit(b + unitSize);
+  if (unitCount > core::numeric_limits<size_t>::max() / unitSize) {
+    return false;
   }
+  r_unitCount = unitCount;
+  r_checksummed = (flags & checksumFlag) != 0;
+  return true;
+}
+
+iu64 BitsetFormat::startChecksum (iu64 unitCount) noexcept {
+  return 0x6A09E667F3BCC908 ^ unitCount;
+}
+
+iu64 BitsetFormat::addToChecksum (iu64 checksum, const iu8 *b, size_t size) noexcept {
+  DPRE(size % unitSize == 0);
+  for (const iu8 *end = b + size; b != end; b += unitSize) {
+    checksum = ((checksum << 23 | checksum >> 41) ^ loadUnit(b)) * 0x9E3779B97F4A7C15;
+  }
+  return checksum;
+}
+
+void BitsetFormat::storeWords (const word *b, size_t size, iu8 *r_o) noexcept {
+#ifdef BITSET_LITTLEENDIAN
+  memcpy(r_o, b, size * sizeof(word));
+#else
+  for (size_t i = 0; i != size; ++i) {
+    for (size_t j = 0; j != sizeof(word); ++j) {
+      *r_o++ = static_cast<iu8>(b[i] >> (j * 8));
+    }
+  }
+#endif
+}
+
+void BitsetFormat::loadWords (const iu8 *b, size_t size, word *r_o) noexcept {
+#ifdef BITSET_LITTLEENDIAN
+  memcpy(r_o, b, size * sizeof(word));
+#else
+  for (size_t i = 0; i != size; ++i) {
+    word w = 0;
+    for (size_t j = sizeof(word); j != 0; --j) {
+      w = (w << 8) | b[j - 1];
+    }
+    r_o[i] = w;
+    b += sizeof(word);
+  }
+#endif
+}
+
+bool BitsetFormat::view (const void *b, size_t size, BitsetView &r_o) noexcept {
+#ifdef BITSET_LITTLEENDIAN
+  const iu8 *bytes = static_cast<const iu8 *>(b);
+  iu64 unitCount;
+  bool checksummed;
+  if (size < headerSize || !parseHeader(bytes, unitCount, checksummed)) {
+    return false;
+  }
+  size_t availableCount = (size - headerSize) / unitSize;
+  if (unitCount > availableCount || (checksummed && unitCount == availableCount)) {
+    return false;
+  }
+
+  const iu8 *payload = bytes + headerSize;
+  if (reinterpret_cast<std::uintptr_t>(payload) % alignof(word) != 0) {
+    return false;
+  }
+  r_o = BitsetView(reinterpret_cast<const word *>(payload), unitCount * (unitSize / sizeof(word)));
+  return true;
+#else
+  return false;
+#endif
+}
+
+BitsetWriter::BitsetWriter (std::ostream &out, size_t wordCount, bool checksummed) : out(out), wordCount(wordCount), writtenCount(0), checksummed(checksummed), bufferUsed(0) {
+  iu64 unitCount = BitsetFormat::getUnitCount(wordCount);
+  iu16 flags = checksummed ? BitsetFormat::checksumFlag : 0;
+  BitsetFormat::storeUnit(
+    static_cast<iu64>(BitsetFormat::magic) | static_cast<iu64>(BitsetFormat::version) << 32 | static_cast<iu64>(flags) << 48,
+    buffer
+  );
+  BitsetFormat::storeUnit(unitCount, buffer + BitsetFormat::unitSize);
+  out.write(reinterpret_cast<const char *>(buffer), BitsetFormat::headerSize);
+  checksum = BitsetFormat::startChecksum(unitCount);
+}
+
+void BitsetWriter::flush () {
+  checksum = BitsetFormat::addToChecksum(checksum, buffer, bufferUsed);
+  out.write(reinterpret_cast<const char *>(buffer), bufferUsed);
+  bufferUsed = 0;
+}
+
+void BitsetWriter::write (const word *b, size_t size) {
+  DPRE(size <= wordCount - writtenCount, "more words must not be written than were declared");
+  writtenCount += size;
+
+  while (size != 0) {
+    size_t n = min(size, (BitsetFormat::bufferSize - bufferUsed) / sizeof(word));
+    BitsetFormat::storeWords(b, n, buffer + bufferUsed);
+    bufferUsed += n * sizeof(word);
+    b += n;
+    size -= n;
+    if (bufferUsed == BitsetFormat::bufferSize) {
+      flush();
+    }
+  }
+}
+
+bool BitsetWriter::finish () {
+  // Fill out the last unit (and any undeclared words) with zeros.
+  size_t paddedCount = BitsetFormat::getUnitCount(wordCount) * (BitsetFormat::unitSize / sizeof(word));
+  while (writtenCount != paddedCount) {
+    size_t n = min(paddedCount - writtenCount, (BitsetFormat::bufferSize - bufferUsed) / sizeof(word));
+    fill(buffer + bufferUsed, buffer + bufferUsed + n * sizeof(word), 0);
+    bufferUsed += n * sizeof(word);
+    writtenCount += n;
+    if (bufferUsed == BitsetFormat::bufferSize) {
+      flush();
+    }
+  }
+  flush();
+
+  if (checksummed) {
+    BitsetFormat::storeUnit(checksum, buffer);
+    out.write(reinterpret_cast<const char *>(buffer), BitsetFormat::unitSize);
+  }
+  return out.good();
+}
+
+bool BitsetWriter::write (std::ostream &out, const BitsetView &bitset, bool trim, bool checksummed) {
+  const word *b = bitset.getWords();
+  size_t size = bitset.getWordCount();
+  if (trim) {
+    while (size != 0 && b[size - 1] == 0) {
+      --size;
+    }
+  }
+
+  BitsetWriter writer(out, size, checksummed);
+  writer.write(b, size);
+  return writer.finish();
+}
+
+BitsetReader::BitsetReader (std::istream &in) noexcept : in(in), wordCount(0), readCount(0), unreadSize(0), checksummed(false), checksum(0), bufferUsed(0), bufferFilled(0) {
+}
+
+bool BitsetReader::open () {
+  if (!in.read(reinterpret_cast<char *>(buffer), BitsetFormat::headerSize)) {
+    return false;
+  }
+  iu64 unitCount;
+  if (!BitsetFormat::parseHeader(buffer, unitCount, checksummed)) {
+    return false;
+  }
+
+  wordCount = unitCount * (BitsetFormat::unitSize / sizeof(word));
+  readCount = 0;
+  unreadSize = unitCount * BitsetFormat::unitSize;
+  checksum = BitsetFormat::startChecksum(unitCount);
+  bufferUsed = 0;
+  bufferFilled = 0;
+  return true;
+}
+
+size_t BitsetReader::getWordCount () const noexcept {
+  return wordCount;
+}
 
-  if (this->b.compare(0, oSize, r.b, 0, oSize) != 0) {
+bool BitsetReader::fill () {
+  size_t size = min(unreadSize, BitsetFormat::bufferSize);
+  if (!in.read(reinterpret_cast<char *>(buffer), size)) {
     return false;
   }
-  for (const word *i = b->data() + oSize, *end = b->data() + b->size(); i != end ; ++i) {
-    if (*i != 0) {
+  checksum = BitsetFormat::addToChecksum(checksum, buffer, size);
+  unreadSize -= size;
+  bufferUsed = 0;
+  bufferFilled = size;
+  return true;
+}
+
+bool BitsetReader::read (word *r_o, size_t size) {
+  DPRE(size <= wordCount - readCount, "more words must not be read than the payload holds");
+  readCount += size;
+
+  while (size != 0) {
+    if (bufferUsed == bufferFilled && !fill()) {
       return false;
     }
+    size_t n = min(size, (bufferFilled - bufferUsed) / sizeof(word));
+    BitsetFormat::loadWords(buffer + bufferUsed, n, r_o);
+    bufferUsed += n * sizeof(word);
+    r_o += n;
+    size -= n;
   }
   return true;
 }
 
-bool Bitset::operator!= (const Bitset &r) const {
-  return !(*this == r);
+bool BitsetReader::finish () {
+  while (unreadSize != 0) {
+    if (!fill()) {
+      return false;
+    }
+  }
+  readCount = wordCount;
+
+  if (!checksummed) {
+    return true;
+  }
+  if (!in.read(reinterpret_cast<char *>(buffer), BitsetFormat::unitSize)) {
+    return false;
+  }
+  return BitsetFormat::loadUnit(buffer) == checksum;
+}
+
+bool BitsetReader::read (std::istream &in, Bitset &r_o) {
+  BitsetReader reader(in);
+  if (!reader.open()) {
+    return false;
+  }
+
+  // Grow the bitset as the payload arrives, rather than trusting the header with the allocation.
+  Bitset o;
+  size_t size = reader.getWordCount();
+  for (size_t i = 0; i != size; ) {
+    size_t n = min(size - i, BitsetFormat::bufferSize / sizeof(word));
+    o.setSizeAny(i + n);
+    if (!reader.read(&o.b[i], n)) {
+      return false;
+    }
+    i += n;
+  }
+  if (!reader.finish()) {
+    return false;
+  }
+
+  r_o = move(o);
+  return true;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+constexpr size_t BitsetStream::defaultChunkSize;
+
+size_t BitsetStream::merge (Kind kind, const word *l, size_t lSize, const word *r, size_t rSize, word *r_o) noexcept {
+  size_t iSize = min(lSize, rSize);
+  switch (kind) {
+    case Kind::OR:
+      Bitset::op(l, r, iSize, r_o, getKernels().orKernel, [] (word v0, word v1) -> word {
+        return v0 | v1;
+      });
+      if (lSize > iSize) {
+        copy(l + iSize, l + lSize, r_o + iSize);
+      } else {
+        copy(r + iSize, r + rSize, r_o + iSize);
+      }
+      return max(lSize, rSize);
+    case Kind::AND:
+      Bitset::op(l, r, iSize, r_o, getKernels().andKernel, [] (word v0, word v1) -> word {
+        return v0 & v1;
+      });
+      return iSize;
+    case Kind::AND_NOT:
+      Bitset::op(l, r, iSize, r_o, getKernels().andNotKernel, [] (word v0, word v1) -> word {
+        return v0 & ~v1;
+      });
+      copy(l + iSize, l + lSize, r_o + iSize);
+      return lSize;
+  }
+  DA(false);
+  return 0;
+}
+
+bool BitsetStream::run (
+  std::istream &lIn, std::istream &rIn, Kind kind, size_t chunkSize,
+  const std::function<void (size_t size)> &begin, const Sink &sink
+) {
+  DPRE(chunkSize >= sizeof(word), "chunkSize must be at least one word");
+
+  BitsetReader l(lIn);
+  BitsetReader r(rIn);
+  if (!l.open() || !r.open()) {
+    return false;
+  }
+  size_t lSize = l.getWordCount();
+  size_t rSize = r.getWordCount();
+  size_t iSize = min(lSize, rSize);
+  size_t lNeed = kind == Kind::AND ? iSize : lSize;
+  size_t rNeed = kind == Kind::OR ? rSize : iSize;
+  size_t end = max(lNeed, rNeed);
+  begin(kind == Kind::OR ? end : lNeed);
+
+  struct Chunk {
+    vector<word> l;
+    vector<word> r;
+    size_t lSize;
+    size_t rSize;
+    bool full = false;
+    bool ok = false;
+  };
+  size_t chunkWords = chunkSize / sizeof(word);
+  size_t bufferWords = min(chunkWords, end);
+  Chunk chunks[2];
+  for (Chunk &chunk : chunks) {
+    chunk.l.resize(min(bufferWords, lNeed));
+    chunk.r.resize(min(bufferWords, rNeed));
+  }
+  vector<word> out(bufferWords);
+  std::mutex m;
+  std::condition_variable condition;
+
+  // Read chunk k + 1 into one buffer while chunk k in the other is merged.
+  std::thread reading([&] () {
+    for (size_t i = 0, k = 0; i < end; i += chunkWords, ++k) {
+      Chunk &chunk = chunks[k % 2];
+      {
+        std::unique_lock<std::mutex> lock(m);
+        condition.wait(lock, [&] () {
+          return !chunk.full;
+        });
+      }
+
+      chunk.lSize = min(chunkWords, lNeed - min(i, lNeed));
+      chunk.rSize = min(chunkWords, rNeed - min(i, rNeed));
+      bool ok = l.read(chunk.l.data(), chunk.lSize) && r.read(chunk.r.data(), chunk.rSize);
+      {
+        std::lock_guard<std::mutex> lock(m);
+        chunk.full = true;
+        chunk.ok = ok;
+      }
+      condition.notify_all();
+      if (!ok) {
+        return;
+      }
+    }
+  });
+
+  bool ok = true;
+  for (size_t i = 0, k = 0; i < end; i += chunkWords, ++k) {
+    Chunk &chunk = chunks[k % 2];
+    {
+      std::unique_lock<std::mutex> lock(m);
+      condition.wait(lock, [&] () {
+        return chunk.full;
+      });
+    }
+    if (!chunk.ok) {
+      ok = false;
+      break;
+    }
+
+    size_t size = merge(kind, chunk.l.data(), chunk.lSize, chunk.r.data(), chunk.rSize, out.data());
+    sink(out.data(), size);
+    {
+      std::lock_guard<std::mutex> lock(m);
+      chunk.full = false;
+    }
+    condition.notify_all();
+  }
+  reading.join();
+
+  return ok && (lNeed != lSize || l.finish()) && (rNeed != rSize || r.finish());
+}
+
+bool BitsetStream::run (std::istream &l, std::istream &r, Kind kind, size_t chunkSize, std::ostream &out, bool checksummed) {
+  unique_ptr<BitsetWriter> writer;
+  return run(l, r, kind, chunkSize, [&] (size_t size) {
+    writer.reset(new BitsetWriter(out, size, checksummed));
+  }, [&] (const word *b, size_t size) {
+    writer->write(b, size);
+  }) && writer->finish();
+}
+
+bool BitsetStream::count (std::istream &l, std::istream &r, Kind kind, size_t chunkSize, size_t &r_count) {
+  size_t total = 0;
+  if (!run(l, r, kind, chunkSize, [] (size_t size) {
+  }, [&] (const word *b, size_t size) {
+    total += Bitset::countBits(b, size);
+  })) {
+    return false;
+  }
+
+  r_count = total;
+  return true;
+}
+
+bool BitsetStream::orOp (std::istream &l, std::istream &r, const Sink &sink, size_t chunkSize) {
+  return run(l, r, Kind::OR, chunkSize, [] (size_t size) {
+  }, sink);
+}
+
+bool BitsetStream::orOp (std::istream &l, std::istream &r, std::ostream &out, bool checksummed, size_t chunkSize) {
+  return run(l, r, Kind::OR, chunkSize, out, checksummed);
+}
+
+bool BitsetStream::andOp (std::istream &l, std::istream &r, const Sink &sink, size_t chunkSize) {
+  return run(l, r, Kind::AND, chunkSize, [] (size_t size) {
+  }, sink);
+}
+
+bool BitsetStream::andOp (std::istream &l, std::istream &r, std::ostream &out, bool checksummed, size_t chunkSize) {
+  return run(l, r, Kind::AND, chunkSize, out, checksummed);
+}
+
+bool BitsetStream::andNot (std::istream &l, std::istream &r, const Sink &sink, size_t chunkSize) {
+  return run(l, r, Kind::AND_NOT, chunkSize, [] (size_t size) {
+  }, sink);
+}
+
+bool BitsetStream::andNot (std::istream &l, std::istream &r, std::ostream &out, bool checksummed, size_t chunkSize) {
+  return run(l, r, Kind::AND_NOT, chunkSize, out, checksummed);
+}
+
+bool BitsetStream::orCount (std::istream &l, std::istream &r, size_t &r_count, size_t chunkSize) {
+  return count(l, r, Kind::OR, chunkSize, r_count);
+}
+
+bool BitsetStream::andCount (std::istream &l, std::istream &r, size_t &r_count, size_t chunkSize) {
+  return count(l, r, Kind::AND, chunkSize, r_count);
+}
+
+bool BitsetStream::andNotCount (std::istream &l, std::istream &r, size_t &r_count, size_t chunkSize) {
+  return count(l, r, Kind::AND_NOT, chunkSize, r_count);
 }
 
 /* -----------------------------------------------------------------------------
@@ -7,6 +7,28 @@
 #define BITSET_ALREADYINCLUDED
 
 #include <core.hpp>
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <climits>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <iosfwd>
+#include <cstddef>
+
+/**
+  The number of bits that a Bitset can hold without allocating.
+*/
+#ifndef BITSET_INLINEBITS
+#define BITSET_INLINEBITS 256
+#endif
 
 namespace bitset {
 
@@ -14,69 +36,1958 @@ namespace bitset {
 ----------------------------------------------------------------------------- */
 extern DC();
 
-class Bitset {
-  prv typedef iu word;
-  prv static constexpr size_t bits = core::numeric_limits<word>::bits;
+/**
+  A source of memory for the words of bitsets, to use in place of the heap. The memory returned must be aligned
+  for any word type.
+*/
+class WordAllocator {
+  prv static thread_local WordAllocator *current;
+  friend class AllocatorScope;
+
+  pub WordAllocator () noexcept = default;
+  pub WordAllocator (const WordAllocator &o) = delete;
+  pub WordAllocator &operator= (const WordAllocator &o) = delete;
+  pub virtual ~WordAllocator () noexcept;
+
+  pub virtual void *allocate (size_t size) = 0;
+  pub virtual void deallocate (void *p, size_t size) noexcept = 0;
+
+  /**
+    Returns the allocator that bitsets created on the calling thread take their words from (or nullptr for the
+    heap).
+  */
+  pub static WordAllocator *getCurrent () noexcept;
+};
+
+/**
+  Makes bitsets created on the calling thread while it exists (including the results of operators) take their words
+  from the given allocator, which must outlive them. Copies take their words from the allocator current when they
+  are made; moves keep theirs, except that assigning to a bitset with a different allocator copies the words.
+*/
+class AllocatorScope {
+  prv WordAllocator *previous;
+
+  pub explicit AllocatorScope (WordAllocator &allocator) noexcept;
+  pub AllocatorScope (const AllocatorScope &o) = delete;
+  pub AllocatorScope &operator= (const AllocatorScope &o) = delete;
+  pub ~AllocatorScope () noexcept;
+};
+
+/**
+  An allocator that carves allocations out of successively bigger blocks and frees nothing until it is released (or
+  destroyed), for temporaries that all die together, e.g. at the end of a request.
+*/
+class MonotonicArena : public WordAllocator {
+  prv struct Block;
+
+  prv Block *blocks;
+  prv char *next;
+  prv char *end;
+  prv size_t nextBlockSize;
+
+  pub explicit MonotonicArena (size_t initialSize = 65536) noexcept;
+  pub ~MonotonicArena () noexcept override;
+
+  pub void *allocate (size_t size) override;
+  pub void deallocate (void *p, size_t size) noexcept override;
+  /**
+    Frees everything allocated from the arena, none of which may still be in use.
+  */
+  pub void release () noexcept;
+};
+
+/**
+  An allocator that keeps freed allocations in lists by power-of-two size class for reuse, taking bigger ones
+  straight from the heap. It is not thread-safe, so is best made thread_local.
+*/
+class PoolAllocator : public WordAllocator {
+  prv static constexpr size_t minClassSize = 64;
+  prv static constexpr size_t maxClassSize = 1 << 20;
+  prv static constexpr size_t classCount = 15;
+  static_assert(minClassSize << (classCount - 1) == maxClassSize, "the classes must run from minClassSize to maxClassSize");
+  prv struct FreeBlock;
+
+  prv FreeBlock *freeLists[classCount];
+
+  pub PoolAllocator () noexcept;
+  pub ~PoolAllocator () noexcept override;
+
+  prv static size_t getClass (size_t size) noexcept;
+  pub void *allocate (size_t size) override;
+  pub void deallocate (void *p, size_t size) noexcept override;
+};
+
+/**
+  A growable array of words that lives inline (without allocating) while it has no more than _inlineSize
+  elements and in memory from its allocator (see WordAllocator) otherwise. It offers the subset of the core::string
+  interface that Bitset uses.
+
+  Each allocated block starts with a reference count, so that while sharing is on, copies can share the block,
+  copying it only when one of them is about to change it (through the non-const accessors).
+*/
+template<typename _Word, size_t _inlineSize> class WordBuffer {
+  static_assert(_inlineSize != 0, "_inlineSize must be non-zero");
+
+  prv static constexpr size_t headerSize = alignof(std::max_align_t);
+  static_assert(headerSize >= sizeof(std::atomic<size_t>) && headerSize % alignof(_Word) == 0, "the header must hold the reference count and keep the words aligned");
+
+  prv _Word *d;
+  prv size_t s;
+  prv size_t c;
+  prv WordAllocator *a;
+  /**
+    Whether copies share the block. (If it is not set, the block is not shared.)
+  */
+  prv bool sharing;
+  prv _Word inlineD[_inlineSize];
+
+  pub WordBuffer () noexcept;
+  pub explicit WordBuffer (WordAllocator *a) noexcept;
+  pub explicit WordBuffer (size_t capacity);
+  pub WordBuffer (const WordBuffer &o);
+  pub WordBuffer (WordBuffer &&o) noexcept;
+  pub WordBuffer &operator= (const WordBuffer &o);
+  pub WordBuffer &operator= (WordBuffer &&o);
+  pub ~WordBuffer () noexcept;
+
+  prv bool isInline () const noexcept;
+  pub WordAllocator *getAllocator () const noexcept;
+  prv _Word *allocate (size_t capacity);
+  prv void deallocate (_Word *d, size_t capacity) noexcept;
+  prv std::atomic<size_t> &getRefCount () const noexcept;
+  prv bool isShared () const noexcept;
+  prv bool canShareWith (const WordBuffer &o) const noexcept;
+  /**
+    Drops this buffer's reference to its block (leaving d dangling).
+  */
+  prv void release () noexcept;
+  prv void detach ();
+  pub void setSharing (bool sharing);
+  prv void setCapacity (size_t capacity);
+  pub size_t size () const noexcept;
+  pub size_t capacity () const noexcept;
+  pub _Word *data ();
+  pub const _Word *data () const noexcept;
+  pub _Word &operator[] (size_t i);
+  pub const _Word &operator[] (size_t i) const noexcept;
+  pub void reserve (size_t capacity);
+  pub void shrink_to_fit ();
+  pub void append (size_t size, _Word w);
+  pub void append_any (size_t size);
+  pub void erase (size_t i) noexcept;
+  pub void clear () noexcept;
+};
+
+/**
+  A fixed set of worker threads that operations share out their chunks across (see Parallel).
+*/
+class ThreadPool {
+  prv struct Job;
+
+  prv std::vector<std::thread> threads;
+  prv std::mutex m;
+  prv std::condition_variable workCondition;
+  prv std::condition_variable doneCondition;
+  prv Job *job;
+  prv size_t generation;
+  prv bool stopping;
+  /**
+    Held while a job is running, so that only one runs at a time.
+  */
+  prv std::mutex jobMutex;
+
+  /**
+    Creates a pool with the given number of threads in all (including the thread that calls forEachChunk(), which
+    works alongside the others).
+  */
+  pub explicit ThreadPool (size_t threadCount = std::thread::hardware_concurrency());
+  pub ThreadPool (const ThreadPool &o) = delete;
+  pub ThreadPool &operator= (const ThreadPool &o) = delete;
+  pub ~ThreadPool () noexcept;
+
+  pub size_t getThreadCount () const noexcept;
+  prv static void runChunks (Job &job) noexcept;
+  prv void work () noexcept;
+  /**
+    Calls op(chunkI) for each chunkI in [0, chunkCount), with the threads each claiming the next unclaimed chunk
+    as they become free, and returns once all have been done. op must not throw.
+  */
+  pub void forEachChunk (size_t chunkCount, const std::function<void (size_t chunkI)> &op);
+};
+
+/**
+  A policy that selects running an operation across the threads of a pool, for operands of at least minBytes
+  bytes (below which the operation runs on the calling thread alone, as normal).
+*/
+struct Parallel {
+  static constexpr size_t defaultMinBytes = 1 << 20;
+
+  ThreadPool &pool;
+  size_t minBytes;
+
+  explicit Parallel (ThreadPool &pool, size_t minBytes = defaultMinBytes) noexcept;
+};
+
+class CompressedBitset;
+class ConcurrentBitset;
+class BitsetView;
+template<typename _Node> class BitsetExpr;
+template<size_t _width> class FixedBitset;
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 iu128;
+#endif
+
+/**
+  A growable bitset stored as an array of _Word, which must be an unsigned integer type (iu32, iu64 and, where the
+  compiler has it, iu128 are instantiated). Wider words mean fewer iterations in the word-at-a-time loops but
+  coarser allocation; Bitset is the instantiation for the platform's native word.
+*/
+template<typename _Word> class BasicBitset {
+  static_assert(static_cast<_Word>(~static_cast<_Word>(0)) > static_cast<_Word>(0), "_Word must be an unsigned integer type");
+
+  friend class CompressedBitset;
+  friend class ConcurrentBitset;
+  template<size_t _width> friend class FixedBitset;
+  friend class BitsetView;
+  friend class BitsetReader;
+  friend class BitsetStream;
+
+  /**
+    The unit of storage: bit i is bit i % bits of word i / bits (so that the words of a bitset, e.g. in a mapped
+    file, can be viewed by a BitsetView).
+  */
+  pub typedef _Word word;
+  // (Computed from the size, since numeric_limits need not know about extended integer types.)
+  prv static constexpr size_t bits = sizeof(word) * CHAR_BIT;
   prv static constexpr word one = 1;
+  prv static constexpr size_t inlineSize = (BITSET_INLINEBITS + bits - 1) / bits;
+  prv typedef WordBuffer<word, inlineSize> Words;
   pub static constexpr size_t nonIndex = core::numeric_limits<size_t>::max();
+  /**
+    Merges the leading whole vectors of the given byte ranges into r_o (which may alias either input), returning
+    the number of bytes processed (a multiple of the vector size, and so of the word size).
+  */
+  prv typedef size_t (*Kernel) (const void *i0, const void *i1, size_t size, void *r_o);
+  /**
+    Returns the number of leading bytes (or trailing bytes, for the kernels that scan back) of the given byte range
+    that lie in whole vectors consisting entirely of the value sought (all zeros or all ones, depending on the
+    kernel) i.e. the number that can be skipped.
+  */
+  prv typedef size_t (*ScanKernel) (const void *b, size_t size);
+  /**
+    Adds the number of set bits in the leading whole units of the given byte range to r_count, returning the
+    number of bytes processed (a multiple of the word size).
+  */
+  prv typedef size_t (*CountKernel) (const void *b, size_t size, size_t &r_count);
+  /**
+    Writes the indices (relative to the start of the range) of the set bits in the leading whole units of the given
+    byte range to r_o, advancing it past them, and returns the number of bytes processed (a multiple of the word
+    size).
+  */
+  prv typedef size_t (*DecodeKernel) (const void *b, size_t size, iu32 *&r_o);
+  prv struct RankDirectory;
+  prv struct Summary;
+  /**
+    What the operations that can leave zero words at the top (&, andNot(), ^, >> and their compound and assigning
+    forms, including over BitsetViews and lazy expressions) do with them: KEEP leaves them; TRIM drops them, so that the words end with the highest set bit (and the
+    width shrinks accordingly), though never below the widest width asked for with ensureWidth() or the width
+    constructor; SHRINK does so too and also gives back memory once less than a quarter of it is in use. Bitsets
+    start off with TRIM.
+  */
+  pub enum class TrimPolicy {KEEP, TRIM, SHRINK};
 
-  prv core::string<word> b;
+  prv Words b;
+  prv mutable std::unique_ptr<RankDirectory> rankDirectory;
+  prv mutable std::unique_ptr<Summary> summary;
+  /**
+    The number of words up to and including the highest non-zero one, or nonIndex if that is not known. (It is
+    atomic because const queries fill it in, and they may run concurrently.)
+  */
+  prv mutable std::atomic<size_t> usedSize;
+  prv TrimPolicy trimPolicy;
+  /**
+    The number of words covering the widest width asked for with ensureWidth(), which trimming leaves in place.
+  */
+  prv size_t minSize;
+  prv bool cachingHash;
+  /**
+    The hash of the bitset, or 0 if that is not known (the hash never being 0). (It is atomic for the same reason as
+    usedSize.)
+  */
+  prv mutable std::atomic<size_t> cachedHash;
 
-  pub Bitset ();
-  pub explicit Bitset (size_t width);
-  prv Bitset (size_t size, bool);
+  pub BasicBitset ();
+  /**
+    Creates an empty bitset that takes its words from allocator (rather than from the current one).
+  */
+  pub explicit BasicBitset (WordAllocator &allocator) noexcept;
+  pub explicit BasicBitset (size_t width);
+  prv BasicBitset (size_t size, bool);
+  pub BasicBitset (const BasicBitset &o);
+  pub BasicBitset (BasicBitset &&o) noexcept;
+  pub BasicBitset &operator= (const BasicBitset &o);
+  pub BasicBitset &operator= (BasicBitset &&o);
+  pub ~BasicBitset () noexcept;
 
+  pub WordAllocator *getAllocator () const noexcept;
+  /**
+    While sharing is enabled, copies of this bitset (with the same allocator) share its words rather than copying
+    them, and whichever is changed first takes its own copy of them then. The copies inherit the setting.
+  */
+  pub void enableSharing () noexcept;
+  pub void disableSharing ();
+  prv bool sharesWords (const BasicBitset &o) const noexcept;
   pub void ensureWidth (size_t width);
+  prv void reserveSize (size_t size);
+  prv void setSizeAny (size_t size);
   prv void ensureWidthForWord (size_t wordI);
   prv bool wordIsWithinWidth (size_t wordI) const noexcept;
-  pub void setExistingBit (size_t i) noexcept;
+  pub void setExistingBit (size_t i);
   pub void setBit (size_t i);
-  pub void clearExistingBit (size_t i) noexcept;
+  pub void clearExistingBit (size_t i);
   pub void clearBit (size_t i);
   pub bool getExistingBit (size_t i) const noexcept;
   pub bool getBit (size_t i) const noexcept;
-  prv template<typename _OutOfRangeResult, typename _ReadOp> size_t getNextBit (size_t i, const _OutOfRangeResult &outOfRangeResult, const _ReadOp &readOp) const noexcept;
+  prv template<typename _OutOfRangeResult, typename _ReadOp> static size_t getNextBit (const word *b, size_t size, size_t i, const _OutOfRangeResult &outOfRangeResult, ScanKernel scanKernel, const _ReadOp &readOp) noexcept;
+  prv static size_t getNextSetBit (const word *b, size_t size, size_t i) noexcept;
+  prv static size_t getNextClearBit (const word *b, size_t size, size_t i) noexcept;
   pub size_t getNextSetBit (size_t i) const noexcept;
   pub size_t getNextClearBit (size_t i) const noexcept;
+  prv template<typename _ReadOp> static size_t getPrevBit (const word *b, size_t size, size_t i, ScanKernel scanKernel, const _ReadOp &readOp) noexcept;
+  prv static size_t getPrevSetBit (const word *b, size_t size, size_t i) noexcept;
+  prv static size_t getPrevClearBit (const word *b, size_t size, size_t i) noexcept;
+  /**
+    Returns the index of the last set (or clear) bit at or before bit i, or nonIndex if there is none. i may be
+    nonIndex, so that i - 1 can be passed on from 0 when walking down.
+  */
+  pub size_t getPrevSetBit (size_t i) const noexcept;
+  pub size_t getPrevClearBit (size_t i) const noexcept;
+  /**
+    Returns the index of the highest set bit, or nonIndex if there is none.
+  */
+  pub size_t getHighestSetBit () const noexcept;
+  prv static iu getLowestSetBit (word w) noexcept;
+  prv static iu getHighestSetBit (word w) noexcept;
+
+  /**
+    Iterates over the indices of the set bits, in increasing order, keeping hold of the current word rather than
+    seeking afresh for each bit. Any change to the bitset invalidates its iterators.
+  */
+  pub class SetBitIterator;
+  pub class SetBitRange;
+  pub SetBitRange setBits () const noexcept;
+  /**
+    As above, but in decreasing order.
+  */
+  pub class ReverseSetBitIterator;
+  pub class ReverseSetBitRange;
+  pub ReverseSetBitRange setBitsInReverse () const noexcept;
+  /**
+    Calls f(i) for the index i of each set bit, in increasing order.
+  */
+  pub template<typename _F> void forEachSetBit (const _F &f) const;
+  /**
+    Writes the indices of the set bits, in increasing order, to r_o (which must have room for count() of them),
+    returning the number written. Every set bit must have an index that fits in an iu32.
+  */
+  pub size_t decode (iu32 *r_o) const noexcept;
+
+  /**
+    Creates a Bitset with the bits at the given indices set, sizing it once up front. fromIndices() takes the
+    indices in any order (traversing them twice); fromSortedIndices() takes them in non-decreasing order and writes
+    each word just once.
+  */
+  pub template<typename _ForwardIterator> static BasicBitset fromIndices (_ForwardIterator begin, _ForwardIterator end);
+  pub template<typename _BidirectionalIterator> static BasicBitset fromSortedIndices (_BidirectionalIterator begin, _BidirectionalIterator end);
+  /**
+    As above, but splitting the work across the threads of parallel's pool when the indices take up at least
+    parallel.minBytes bytes.
+  */
+  pub template<typename _RandomAccessIterator> static BasicBitset fromIndices (_RandomAccessIterator begin, _RandomAccessIterator end, const Parallel &parallel);
+  pub template<typename _RandomAccessIterator> static BasicBitset fromSortedIndices (_RandomAccessIterator begin, _RandomAccessIterator end, const Parallel &parallel);
+  prv template<typename _ForwardIterator> static void setSortedIndices (word *b, _ForwardIterator begin, _ForwardIterator end) noexcept;
   pub void clear () noexcept;
+  prv static bool isZero (const word *b, size_t size) noexcept;
+  prv static bool isOnes (const word *b, size_t size) noexcept;
   pub bool empty () const noexcept;
   pub void compact ();
+  /**
+    Returns the number of words up to and including the highest non-zero one. Changes to single bits keep it up to
+    date; after other changes it is found afresh on demand, scanning down over any zero words at the top.
+  */
+  prv static size_t getUsedSize (const word *b, size_t size) noexcept;
+  prv size_t getUsedSize () const noexcept;
+  pub void setTrimPolicy (TrimPolicy policy);
+  pub TrimPolicy getTrimPolicy () const noexcept;
+  prv void trim ();
+  /**
+    Notes that the words from wordI on may have changed (or that only word wordI has).
+  */
+  prv void noteChange (size_t wordI) const noexcept;
+  prv void noteWordChange (size_t wordI) const noexcept;
+
+  /**
+    Calls edgeOp(wordI, mask) for each word only partly within the (non-empty) range of bits [begin, end) and
+    middleOp(beginWordI, endWordI) for the run of words wholly within it.
+  */
+  prv template<typename _EdgeOp, typename _MiddleOp> static void forRange (size_t begin, size_t end, const _EdgeOp &edgeOp, const _MiddleOp &middleOp);
+  prv size_t clampToWidth (size_t i) const noexcept;
+  /**
+    Operates on the bits in [begin, end).
+  */
+  pub void setRange (size_t begin, size_t end);
+  pub void clearRange (size_t begin, size_t end);
+  pub void flipRange (size_t begin, size_t end);
+  pub size_t countRange (size_t begin, size_t end) const noexcept;
+  pub bool anyInRange (size_t begin, size_t end) const noexcept;
+  pub bool allInRange (size_t begin, size_t end) const noexcept;
+
+  /**
+    Maintains a directory of the number of bits set before each block of the bitset, making rank() and select()
+    run in near-constant time. The directory is updated lazily, on the first query after a change, so while it is
+    enabled, rank() and select() write to the bitset and must not run concurrently with other queries. To share the
+    bitset between reading threads, call refreshRankIndex() after the last change, which brings the directory up to
+    date so that queries only read it.
+  */
+  pub void enableRankIndex ();
+  pub void disableRankIndex () noexcept;
+  pub void refreshRankIndex ();
+  prv void updateRankIndex (size_t blockCount) const;
+  /**
+    Maintains a two-level summary of the words of the bitset (a bit per word saying whether it is non-zero, and a
+    bit per word of those saying the same of it; and likewise for words that are not all ones), letting
+    getNextSetBit(), getNextClearBit(), empty() and compact() skip runs of empty (or full) words. Changes to single
+    bits update it in place; other changes are caught up with lazily, as for the rank index, so the same applies to
+    reading the bitset from several threads: call refreshSummaryIndex() after the last change first.
+  */
+  pub void enableSummaryIndex ();
+  pub void disableSummaryIndex () noexcept;
+  pub void refreshSummaryIndex ();
+  prv void updateSummaryIndex () const;
+  prv static size_t countBits (const word *b, size_t size) noexcept;
+  pub size_t count () const noexcept;
+  /**
+    Returns the number of set bits before bit i.
+  */
+  pub size_t rank (size_t i) const;
+  /**
+    Returns the index of the set bit with rank k (i.e. the (k + 1)th set bit), or nonIndex if there is none.
+  */
+  pub size_t select (size_t k) const;
 
   prv template<typename _MergeOp> static void op (
-    const core::string<word> &i0, const core::string<word> &i1, size_t iSize,
-    core::string<word> &r_o, _MergeOp mergeOp
+    const word *i0, const word *i1, size_t iSize, word *r_o, Kernel kernel, _MergeOp mergeOp
+  ) noexcept;
+  prv template<typename _MergeOp> static void op (
+    const Words &i0, const Words &i1, size_t iSize,
+    Words &r_o, Kernel kernel, _MergeOp mergeOp
+  );
+  prv template<typename _MergeOp, typename _RemainderOp> static void op (
+    const Words &i0, size_t i0Size, const Words &i1, size_t i1Size,
+    Words &r_o, Kernel kernel, _MergeOp mergeOp, _RemainderOp remainderOp
   );
+  prv static void orOp (const Words &i0, size_t i0Size, const Words &i1, size_t i1Size, Words &r_o);
+  prv static void andOp (const Words &i0, const Words &i1, size_t iSize, Words &r_o);
+  prv static void andNotOp (const Words &i0, size_t i0Size, const Words &i1, size_t i1Size, Words &r_o);
+  prv static void xorOp (const Words &i0, size_t i0Size, const Words &i1, size_t i1Size, Words &r_o);
+  pub BasicBitset &operator|= (BasicBitset &&r);
+  pub BasicBitset &operator|= (const BasicBitset &r);
+  template<typename _W> friend BasicBitset<_W> operator| (BasicBitset<_W> &&l, BasicBitset<_W> &&r);
+  template<typename _W> friend BasicBitset<_W> operator| (BasicBitset<_W> &&l, const BasicBitset<_W> &r);
+  template<typename _W> friend BasicBitset<_W> operator| (const BasicBitset<_W> &l, BasicBitset<_W> &&r);
+  template<typename _W> friend BasicBitset<_W> operator| (const BasicBitset<_W> &l, const BasicBitset<_W> &r);
+  pub BasicBitset &operator&= (BasicBitset &&r);
+  pub BasicBitset &operator&= (const BasicBitset &r);
+  template<typename _W> friend BasicBitset<_W> operator& (BasicBitset<_W> &&l, BasicBitset<_W> &&r);
+  template<typename _W> friend BasicBitset<_W> operator& (BasicBitset<_W> &&l, const BasicBitset<_W> &r);
+  template<typename _W> friend BasicBitset<_W> operator& (const BasicBitset<_W> &l, BasicBitset<_W> &&r);
+  template<typename _W> friend BasicBitset<_W> operator& (const BasicBitset<_W> &l, const BasicBitset<_W> &r);
+  pub BasicBitset &andNot (BasicBitset &&r);
+  pub BasicBitset &andNot (const BasicBitset &r);
+  pub static BasicBitset andNot (BasicBitset &&l, BasicBitset &&r);
+  pub static BasicBitset andNot (BasicBitset &&l, const BasicBitset &r);
+  pub static BasicBitset andNot (const BasicBitset &l, BasicBitset &&r);
+  pub static BasicBitset andNot (const BasicBitset &l, const BasicBitset &r);
+  pub BasicBitset &operator^= (BasicBitset &&r);
+  pub BasicBitset &operator^= (const BasicBitset &r);
+  template<typename _W> friend BasicBitset<_W> operator^ (BasicBitset<_W> &&l, BasicBitset<_W> &&r);
+  template<typename _W> friend BasicBitset<_W> operator^ (BasicBitset<_W> &&l, const BasicBitset<_W> &r);
+  template<typename _W> friend BasicBitset<_W> operator^ (const BasicBitset<_W> &l, BasicBitset<_W> &&r);
+  template<typename _W> friend BasicBitset<_W> operator^ (const BasicBitset<_W> &l, const BasicBitset<_W> &r);
+  /**
+    Complements the bits in [0, width).
+  */
+  pub BasicBitset &flip (size_t width);
+  pub static BasicBitset flip (BasicBitset &&l, size_t width);
+  pub static BasicBitset flip (const BasicBitset &l, size_t width);
+  /**
+    Moves each bit k places towards the higher (for <<) or lower (for >>) indices; bits moved below index 0 are
+    lost.
+  */
+  pub BasicBitset &operator<<= (size_t k);
+  pub BasicBitset &operator>>= (size_t k);
+  template<typename _W> friend BasicBitset<_W> operator<< (BasicBitset<_W> &&l, size_t k);
+  template<typename _W> friend BasicBitset<_W> operator<< (const BasicBitset<_W> &l, size_t k);
+  template<typename _W> friend BasicBitset<_W> operator>> (BasicBitset<_W> &&l, size_t k);
+  template<typename _W> friend BasicBitset<_W> operator>> (const BasicBitset<_W> &l, size_t k);
+  /**
+    Stores the result of the operation in r_o (which may be one of the operands), reusing its storage.
+  */
+  pub static void assignOr (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r);
+  pub static void assignAnd (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r);
+  pub static void assignAndNot (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r);
+  prv static bool equal (const word *l, size_t lSize, const word *r, size_t rSize) noexcept;
+  pub bool operator== (const BasicBitset &r) const;
+  pub bool operator!= (const BasicBitset &r) const;
+  /**
+    Orders bitsets as the unsigned numbers that they represent (bit i being worth 2^i), consistently with ==.
+    Bitsets whose highest set bits lie in different words are ordered without reading their words. compare()
+    returns a negative, zero or positive value as l is less than, equal to or greater than r.
+  */
+  pub static int compare (const BasicBitset &l, const BasicBitset &r) noexcept;
+  pub bool operator< (const BasicBitset &r) const noexcept;
+  pub bool operator<= (const BasicBitset &r) const noexcept;
+  pub bool operator> (const BasicBitset &r) const noexcept;
+  pub bool operator>= (const BasicBitset &r) const noexcept;
+  /**
+    Returns a hash of the bitset that is consistent with == (the zero words at the top not contributing to it),
+    mixing two 64-bit units at a time on each of two independent lanes. While the hash cache is enabled, the hash is
+    kept until the bitset next changes.
+  */
+  pub size_t hash () const noexcept;
+  pub void enableHashCache () noexcept;
+  pub void disableHashCache () noexcept;
+
+  /**
+    The same operations, split into cache-line-aligned chunks that are shared out across parallel's pool.
+  */
+  prv static constexpr size_t parallelChunkWords = 65536 / sizeof(word);
+  prv template<typename _ChunkOp> static void forChunks (const Parallel &parallel, const word *base, size_t size, const _ChunkOp &chunkOp);
   prv template<typename _MergeOp, typename _RemainderOp> static void op (
-    const core::string<word> &i0, size_t i0Size, const core::string<word> &i1, size_t i1Size,
-    core::string<word> &r_o, _MergeOp mergeOp, _RemainderOp remainderOp
+    const Parallel &parallel, const word *i0, size_t i0Size, const word *i1, size_t i1Size,
+    word *r_o, Kernel kernel, _MergeOp mergeOp, _RemainderOp remainderOp
+  );
+  pub static void assignOr (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r, const Parallel &parallel);
+  pub static void assignAnd (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r, const Parallel &parallel);
+  pub static void assignAndNot (BasicBitset &r_o, const BasicBitset &l, const BasicBitset &r, const Parallel &parallel);
+  pub bool empty (const Parallel &parallel) const;
+  pub size_t count (const Parallel &parallel) const;
+  pub static bool equal (const BasicBitset &l, const BasicBitset &r, const Parallel &parallel);
+
+  /**
+    Answers questions about the result of an operation without building it. Each merges the operands a small,
+    cache-resident block at a time and (for the predicates) stops at the first block that decides the answer.
+  */
+  prv static constexpr size_t scratchWords = 1024 / sizeof(word);
+  prv template<typename _MergeOp, typename _BlockOp> static bool forMergedBlocks (
+    const word *i0, const word *i1, size_t size, Kernel kernel, _MergeOp mergeOp, const _BlockOp &blockOp
+  ) noexcept;
+  pub static bool intersects (const BasicBitset &l, const BasicBitset &r) noexcept;
+  pub static bool isDisjoint (const BasicBitset &l, const BasicBitset &r) noexcept;
+  /**
+    Returns whether every bit set in l is also set in r.
+  */
+  pub static bool isSubsetOf (const BasicBitset &l, const BasicBitset &r) noexcept;
+  pub static size_t andCount (const BasicBitset &l, const BasicBitset &r) noexcept;
+  pub static size_t orCount (const BasicBitset &l, const BasicBitset &r) noexcept;
+  pub static size_t andNotCount (const BasicBitset &l, const BasicBitset &r) noexcept;
+  /**
+    Returns andCount(l, r) / orCount(l, r) (or 1 if both are empty).
+  */
+  pub static double jaccard (const BasicBitset &l, const BasicBitset &r) noexcept;
+
+  /**
+    The nodes of lazily-evaluated expressions (see BitsetExpr).
+  */
+  pub struct LeafNode;
+  pub template<typename _Merge, typename _L, typename _R> struct OpNode;
+  pub struct OrMerge;
+  pub struct AndMerge;
+  pub struct AndNotMerge;
+  pub template<typename _Node> BasicBitset (const BitsetExpr<_Node> &expr);
+  pub template<typename _Node> BasicBitset &operator= (const BitsetExpr<_Node> &expr);
+  pub template<typename _L, typename _R> static BitsetExpr<OpNode<AndNotMerge, _L, _R>> andNot (const BitsetExpr<_L> &l, const BitsetExpr<_R> &r);
+  pub template<typename _L> static BitsetExpr<OpNode<AndNotMerge, _L, LeafNode>> andNot (const BitsetExpr<_L> &l, const BasicBitset &r);
+  pub template<typename _R> static BitsetExpr<OpNode<AndNotMerge, LeafNode, _R>> andNot (const BasicBitset &l, const BitsetExpr<_R> &r);
+
+  /**
+    Returns the union (or intersection) of the Bitsets in the given range, making a single, blockwise pass over
+    them. (The intersection of no bitsets is returned as an empty bitset.)
+  */
+  pub template<typename _InputIterator> static BasicBitset orAll (_InputIterator begin, _InputIterator end);
+  pub template<typename _Range> static BasicBitset orAll (const _Range &bitsets);
+  pub template<typename _InputIterator> static BasicBitset andAll (_InputIterator begin, _InputIterator end);
+  pub template<typename _Range> static BasicBitset andAll (const _Range &bitsets);
+  prv static constexpr size_t blockWords = 8192 / sizeof(word);
+  prv static BasicBitset orAllImpl (const BasicBitset *const *bitsets, size_t count);
+  prv static BasicBitset andAllImpl (const BasicBitset *const *bitsets, size_t count);
+};
+
+/**
+  The bitset over the platform's native word.
+*/
+typedef BasicBitset<std::conditional<sizeof(size_t) >= sizeof(iu64), iu64, iu32>::type> Bitset;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+inline WordAllocator *WordAllocator::getCurrent () noexcept {
+  return current;
+}
+
+template<typename _Word, size_t _inlineSize> constexpr size_t WordBuffer<_Word, _inlineSize>::headerSize;
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize>::WordBuffer () noexcept : WordBuffer(WordAllocator::getCurrent()) {
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize>::WordBuffer (WordAllocator *a) noexcept : d(inlineD), s(0), c(_inlineSize), a(a), sharing(false) {
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize>::WordBuffer (size_t capacity) : WordBuffer() {
+  reserve(capacity);
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize>::WordBuffer (const WordBuffer &o) : WordBuffer() {
+  sharing = o.sharing;
+  if (canShareWith(o)) {
+    o.getRefCount().fetch_add(1, std::memory_order_relaxed);
+    d = o.d;
+    c = o.c;
+    s = o.s;
+    return;
+  }
+
+  reserve(o.s);
+  std::copy(o.d, o.d + o.s, d);
+  s = o.s;
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize>::WordBuffer (WordBuffer &&o) noexcept : WordBuffer(o.a) {
+  // (With the same allocator, this cannot need to copy into new storage.)
+  sharing = o.sharing;
+  *this = std::move(o);
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize> &WordBuffer<_Word, _inlineSize>::operator= (const WordBuffer &o) {
+  if (this == &o) {
+    return *this;
+  }
+
+  sharing = sharing || o.sharing;
+  if (canShareWith(o)) {
+    if (d != o.d) {
+      o.getRefCount().fetch_add(1, std::memory_order_relaxed);
+      release();
+      d = o.d;
+      c = o.c;
+    }
+    s = o.s;
+    return *this;
+  }
+
+  if (isShared()) {
+    // (Others can see our storage, so it cannot be reused.)
+    release();
+    d = inlineD;
+    c = _inlineSize;
+  }
+  // Reuse the existing storage if it is big enough.
+  if (o.s > c) {
+    _Word *newD = allocate(o.s);
+    release();
+    d = newD;
+    c = o.s;
+  }
+  std::copy(o.d, o.d + o.s, d);
+  s = o.s;
+  return *this;
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize> &WordBuffer<_Word, _inlineSize>::operator= (WordBuffer &&o) {
+  if (this == &o) {
+    return *this;
+  }
+
+  if (o.a != a && !o.isInline()) {
+    // o's storage must not outlive its allocator by ending up in ours.
+    *this = static_cast<const WordBuffer &>(o);
+    o.s = 0;
+    return *this;
+  }
+  if (o.isInline()) {
+    if (isShared()) {
+      release();
+      d = inlineD;
+      c = _inlineSize;
+    }
+    // (Our storage is always at least as big as the inline storage.)
+    std::copy(o.d, o.d + o.s, d);
+  } else {
+    release();
+    d = o.d;
+    c = o.c;
+    sharing = sharing || o.sharing;
+    o.d = o.inlineD;
+    o.c = _inlineSize;
+  }
+  s = o.s;
+  o.s = 0;
+  return *this;
+}
+
+template<typename _Word, size_t _inlineSize> WordBuffer<_Word, _inlineSize>::~WordBuffer () noexcept {
+  release();
+}
+
+template<typename _Word, size_t _inlineSize> bool WordBuffer<_Word, _inlineSize>::isInline () const noexcept {
+  return d == inlineD;
+}
+
+template<typename _Word, size_t _inlineSize> WordAllocator *WordBuffer<_Word, _inlineSize>::getAllocator () const noexcept {
+  return a;
+}
+
+template<typename _Word, size_t _inlineSize> _Word *WordBuffer<_Word, _inlineSize>::allocate (size_t capacity) {
+  size_t size = headerSize + capacity * sizeof(_Word);
+  char *block = static_cast<char *>(a ? a->allocate(size) : ::operator new(size));
+  new (block) std::atomic<size_t>(1);
+  return reinterpret_cast<_Word *>(block + headerSize);
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::deallocate (_Word *d, size_t capacity) noexcept {
+  char *block = reinterpret_cast<char *>(d) - headerSize;
+  if (a) {
+    a->deallocate(block, headerSize + capacity * sizeof(_Word));
+  } else {
+    ::operator delete(block);
+  }
+}
+
+template<typename _Word, size_t _inlineSize> std::atomic<size_t> &WordBuffer<_Word, _inlineSize>::getRefCount () const noexcept {
+  DPRE(!isInline());
+  return *reinterpret_cast<std::atomic<size_t> *>(reinterpret_cast<char *>(d) - headerSize);
+}
+
+template<typename _Word, size_t _inlineSize> bool WordBuffer<_Word, _inlineSize>::isShared () const noexcept {
+  return sharing && !isInline() && getRefCount().load(std::memory_order_acquire) != 1;
+}
+
+template<typename _Word, size_t _inlineSize> bool WordBuffer<_Word, _inlineSize>::canShareWith (const WordBuffer &o) const noexcept {
+  return o.sharing && !o.isInline() && o.a == a;
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::release () noexcept {
+  if (!isInline() && (!sharing || getRefCount().fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+    deallocate(d, c);
+  }
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::detach () {
+  if (isShared()) {
+    _Word *newD = allocate(c);
+    std::copy(d, d + s, newD);
+    release();
+    d = newD;
+  }
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::setSharing (bool sharing) {
+  if (!sharing) {
+    detach();
+  }
+  this->sharing = sharing;
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::setCapacity (size_t capacity) {
+  DPRE(capacity >= s);
+  if (capacity <= _inlineSize) {
+    if (!isInline()) {
+      std::copy(d, d + s, inlineD);
+      release();
+      d = inlineD;
+      c = _inlineSize;
+    }
+    return;
+  }
+
+  _Word *newD = allocate(capacity);
+  std::copy(d, d + s, newD);
+  release();
+  d = newD;
+  c = capacity;
+}
+
+template<typename _Word, size_t _inlineSize> size_t WordBuffer<_Word, _inlineSize>::size () const noexcept {
+  return s;
+}
+
+template<typename _Word, size_t _inlineSize> size_t WordBuffer<_Word, _inlineSize>::capacity () const noexcept {
+  return c;
+}
+
+template<typename _Word, size_t _inlineSize> _Word *WordBuffer<_Word, _inlineSize>::data () {
+  detach();
+  return d;
+}
+
+template<typename _Word, size_t _inlineSize> const _Word *WordBuffer<_Word, _inlineSize>::data () const noexcept {
+  return d;
+}
+
+template<typename _Word, size_t _inlineSize> _Word &WordBuffer<_Word, _inlineSize>::operator[] (size_t i) {
+  DPRE(i < s);
+  detach();
+  return d[i];
+}
+
+template<typename _Word, size_t _inlineSize> const _Word &WordBuffer<_Word, _inlineSize>::operator[] (size_t i) const noexcept {
+  DPRE(i < s);
+  return d[i];
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::reserve (size_t capacity) {
+  if (capacity > c) {
+    setCapacity(capacity);
+  }
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::shrink_to_fit () {
+  if (c > s) {
+    setCapacity(s);
+  }
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::append (size_t size, _Word w) {
+  append_any(size);
+  std::fill(d + s - size, d + s, w);
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::append_any (size_t size) {
+  if (size > c - s) {
+    setCapacity(std::max(s + size, c * 2));
+  } else {
+    detach();
+  }
+  s += size;
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::erase (size_t i) noexcept {
+  DPRE(i <= s);
+  s = i;
+}
+
+template<typename _Word, size_t _inlineSize> void WordBuffer<_Word, _inlineSize>::clear () noexcept {
+  s = 0;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+template<typename _Word> inline iu BasicBitset<_Word>::getLowestSetBit (word w) noexcept {
+  return core::getLowestSetBit(w);
+}
+
+#ifdef __SIZEOF_INT128__
+// (Core's bit functions need not know about extended integer types, so 128-bit words are handled in halves.)
+template<> inline iu BasicBitset<iu128>::getLowestSetBit (iu128 w) noexcept {
+  iu64 lo = static_cast<iu64>(w);
+  return lo != 0 ? core::getLowestSetBit(lo) : 64 + core::getLowestSetBit(static_cast<iu64>(w >> 64));
+}
+#endif
+
+template<typename _Word> inline iu BasicBitset<_Word>::getHighestSetBit (word w) noexcept {
+  if (w == 0) {
+    return bits;
+  }
+#ifdef __GNUC__
+  return static_cast<iu>(sizeof(word) <= sizeof(unsigned int) ? 31 - __builtin_clz(static_cast<unsigned int>(w)) : 63 - __builtin_clzll(w));
+#else
+  iu i = bits - 1;
+  for (; (w >> i) == 0; --i) {
+  }
+  return i;
+#endif
+}
+
+#ifdef __SIZEOF_INT128__
+template<> inline iu BasicBitset<iu128>::getHighestSetBit (iu128 w) noexcept {
+  iu64 hi = static_cast<iu64>(w >> 64);
+  iu64 lo = static_cast<iu64>(w);
+  return hi != 0 ? 127 - static_cast<iu>(__builtin_clzll(hi)) : lo != 0 ? 63 - static_cast<iu>(__builtin_clzll(lo)) : 128;
+}
+#endif
+
+template<typename _Word> class BasicBitset<_Word>::SetBitIterator {
+  pub typedef std::forward_iterator_tag iterator_category;
+  pub typedef size_t value_type;
+  pub typedef std::ptrdiff_t difference_type;
+  pub typedef const size_t *pointer;
+  pub typedef size_t reference;
+
+  prv const word *b;
+  prv size_t size;
+  prv size_t wordI;
+  /**
+    The bits of the current word that have yet to be visited.
+  */
+  prv word w;
+
+  pub SetBitIterator (const word *b, size_t size, size_t wordI) noexcept;
+
+  prv void seek () noexcept;
+  pub size_t operator* () const noexcept;
+  pub SetBitIterator &operator++ () noexcept;
+  pub SetBitIterator operator++ (int) noexcept;
+  pub bool operator== (const SetBitIterator &r) const noexcept;
+  pub bool operator!= (const SetBitIterator &r) const noexcept;
+};
+
+template<typename _Word> class BasicBitset<_Word>::SetBitRange {
+  prv SetBitIterator b;
+  prv SetBitIterator e;
+
+  pub SetBitRange (const SetBitIterator &b, const SetBitIterator &e) noexcept;
+
+  pub SetBitIterator begin () const noexcept;
+  pub SetBitIterator end () const noexcept;
+};
+
+template<typename _Word> class BasicBitset<_Word>::ReverseSetBitIterator {
+  pub typedef std::forward_iterator_tag iterator_category;
+  pub typedef size_t value_type;
+  pub typedef std::ptrdiff_t difference_type;
+  pub typedef const size_t *pointer;
+  pub typedef size_t reference;
+
+  prv const word *b;
+  /**
+    One more than the index of the current word (so that the end is at 0).
+  */
+  prv size_t wordEnd;
+  /**
+    The bits of the current word that have yet to be visited.
+  */
+  prv word w;
+
+  pub ReverseSetBitIterator (const word *b, size_t wordEnd) noexcept;
+
+  prv void seek () noexcept;
+  pub size_t operator* () const noexcept;
+  pub ReverseSetBitIterator &operator++ () noexcept;
+  pub ReverseSetBitIterator operator++ (int) noexcept;
+  pub bool operator== (const ReverseSetBitIterator &r) const noexcept;
+  pub bool operator!= (const ReverseSetBitIterator &r) const noexcept;
+};
+
+template<typename _Word> class BasicBitset<_Word>::ReverseSetBitRange {
+  prv ReverseSetBitIterator b;
+  prv ReverseSetBitIterator e;
+
+  pub ReverseSetBitRange (const ReverseSetBitIterator &b, const ReverseSetBitIterator &e) noexcept;
+
+  pub ReverseSetBitIterator begin () const noexcept;
+  pub ReverseSetBitIterator end () const noexcept;
+};
+
+template<typename _Word> BasicBitset<_Word>::SetBitIterator::SetBitIterator (const word *b, size_t size, size_t wordI) noexcept : b(b), size(size), wordI(wordI), w(wordI < size ? b[wordI] : 0) {
+  seek();
+}
+
+template<typename _Word> inline void BasicBitset<_Word>::SetBitIterator::seek () noexcept {
+  while (w == 0 && wordI != size) {
+    if (++wordI != size) {
+      w = b[wordI];
+    }
+  }
+}
+
+template<typename _Word> inline size_t BasicBitset<_Word>::SetBitIterator::operator* () const noexcept {
+  DPRE(w != 0);
+  return wordI * bits + BasicBitset::getLowestSetBit(w);
+}
+
+template<typename _Word> inline typename BasicBitset<_Word>::SetBitIterator &BasicBitset<_Word>::SetBitIterator::operator++ () noexcept {
+  DPRE(w != 0);
+  w &= w - 1;
+  seek();
+  return *this;
+}
+
+template<typename _Word> inline typename BasicBitset<_Word>::SetBitIterator BasicBitset<_Word>::SetBitIterator::operator++ (int) noexcept {
+  SetBitIterator o = *this;
+  ++*this;
+  return o;
+}
+
+template<typename _Word> inline bool BasicBitset<_Word>::SetBitIterator::operator== (const SetBitIterator &r) const noexcept {
+  return wordI == r.wordI && w == r.w;
+}
+
+template<typename _Word> inline bool BasicBitset<_Word>::SetBitIterator::operator!= (const SetBitIterator &r) const noexcept {
+  return !(*this == r);
+}
+
+template<typename _Word> BasicBitset<_Word>::SetBitRange::SetBitRange (const SetBitIterator &b, const SetBitIterator &e) noexcept : b(b), e(e) {
+}
+
+template<typename _Word> typename BasicBitset<_Word>::SetBitIterator BasicBitset<_Word>::SetBitRange::begin () const noexcept {
+  return b;
+}
+
+template<typename _Word> typename BasicBitset<_Word>::SetBitIterator BasicBitset<_Word>::SetBitRange::end () const noexcept {
+  return e;
+}
+
+template<typename _Word> typename BasicBitset<_Word>::SetBitRange BasicBitset<_Word>::setBits () const noexcept {
+  size_t size = b.size();
+  return SetBitRange(SetBitIterator(b.data(), size, 0), SetBitIterator(b.data(), size, size));
+}
+
+template<typename _Word> BasicBitset<_Word>::ReverseSetBitIterator::ReverseSetBitIterator (const word *b, size_t wordEnd) noexcept : b(b), wordEnd(wordEnd), w(wordEnd != 0 ? b[wordEnd - 1] : 0) {
+  seek();
+}
+
+template<typename _Word> inline void BasicBitset<_Word>::ReverseSetBitIterator::seek () noexcept {
+  while (w == 0 && wordEnd != 0) {
+    if (--wordEnd != 0) {
+      w = b[wordEnd - 1];
+    }
+  }
+}
+
+template<typename _Word> inline size_t BasicBitset<_Word>::ReverseSetBitIterator::operator* () const noexcept {
+  DPRE(w != 0);
+  return (wordEnd - 1) * bits + BasicBitset::getHighestSetBit(w);
+}
+
+template<typename _Word> inline typename BasicBitset<_Word>::ReverseSetBitIterator &BasicBitset<_Word>::ReverseSetBitIterator::operator++ () noexcept {
+  DPRE(w != 0);
+  w ^= one << BasicBitset::getHighestSetBit(w);
+  seek();
+  return *this;
+}
+
+template<typename _Word> inline typename BasicBitset<_Word>::ReverseSetBitIterator BasicBitset<_Word>::ReverseSetBitIterator::operator++ (int) noexcept {
+  ReverseSetBitIterator o = *this;
+  ++*this;
+  return o;
+}
+
+template<typename _Word> inline bool BasicBitset<_Word>::ReverseSetBitIterator::operator== (const ReverseSetBitIterator &r) const noexcept {
+  return wordEnd == r.wordEnd && w == r.w;
+}
+
+template<typename _Word> inline bool BasicBitset<_Word>::ReverseSetBitIterator::operator!= (const ReverseSetBitIterator &r) const noexcept {
+  return !(*this == r);
+}
+
+template<typename _Word> BasicBitset<_Word>::ReverseSetBitRange::ReverseSetBitRange (const ReverseSetBitIterator &b, const ReverseSetBitIterator &e) noexcept : b(b), e(e) {
+}
+
+template<typename _Word> typename BasicBitset<_Word>::ReverseSetBitIterator BasicBitset<_Word>::ReverseSetBitRange::begin () const noexcept {
+  return b;
+}
+
+template<typename _Word> typename BasicBitset<_Word>::ReverseSetBitIterator BasicBitset<_Word>::ReverseSetBitRange::end () const noexcept {
+  return e;
+}
+
+template<typename _Word> typename BasicBitset<_Word>::ReverseSetBitRange BasicBitset<_Word>::setBitsInReverse () const noexcept {
+  // (Start below any zero words at the top.)
+  return ReverseSetBitRange(ReverseSetBitIterator(b.data(), getUsedSize()), ReverseSetBitIterator(b.data(), 0));
+}
+
+template<typename _Word> template<typename _F> void BasicBitset<_Word>::forEachSetBit (const _F &f) const {
+  const word *i = b.data();
+  for (size_t wordI = 0, end = b.size(); wordI != end; ++wordI) {
+    for (word w = i[wordI]; w != 0; w &= w - 1) {
+      f(wordI * bits + getLowestSetBit(w));
+    }
+  }
+}
+
+template<typename _Word> template<typename _ForwardIterator> BasicBitset<_Word> BasicBitset<_Word>::fromIndices (_ForwardIterator begin, _ForwardIterator end) {
+  size_t size = 0;
+  for (_ForwardIterator i = begin; i != end; ++i) {
+    size_t wordI = static_cast<size_t>(*i) / bits;
+    size = wordI < size ? size : wordI + 1;
+  }
+
+  BasicBitset o;
+  if (size != 0) {
+    o.ensureWidthForWord(size - 1);
+  }
+  word *b = o.b.data();
+  for (; begin != end; ++begin) {
+    size_t i = static_cast<size_t>(*begin);
+    b[i / bits] |= one << (i % bits);
+  }
+  return o;
+}
+
+template<typename _Word> template<typename _BidirectionalIterator> BasicBitset<_Word> BasicBitset<_Word>::fromSortedIndices (_BidirectionalIterator begin, _BidirectionalIterator end) {
+  BasicBitset o;
+  if (begin != end) {
+    o.ensureWidthForWord(static_cast<size_t>(*std::prev(end)) / bits);
+    setSortedIndices(o.b.data(), begin, end);
+  }
+  return o;
+}
+
+template<typename _Word> template<typename _RandomAccessIterator> BasicBitset<_Word> BasicBitset<_Word>::fromIndices (_RandomAccessIterator begin, _RandomAccessIterator end, const Parallel &parallel) {
+  size_t count = static_cast<size_t>(end - begin);
+  if (count * sizeof(typename std::iterator_traits<_RandomAccessIterator>::value_type) < parallel.minBytes) {
+    return fromIndices(begin, end);
+  }
+
+  size_t threadCount = parallel.pool.getThreadCount();
+  std::vector<size_t> sizes(threadCount, 0);
+  parallel.pool.forEachChunk(threadCount, [&] (size_t t) {
+    size_t size = 0;
+    for (_RandomAccessIterator i = begin + count * t / threadCount, iEnd = begin + count * (t + 1) / threadCount; i != iEnd; ++i) {
+      size_t wordI = static_cast<size_t>(*i) / bits;
+      size = wordI < size ? size : wordI + 1;
+    }
+    sizes[t] = size;
+  });
+  size_t size = *std::max_element(sizes.begin(), sizes.end());
+
+  BasicBitset o;
+  if (size == 0) {
+    return o;
+  }
+  o.ensureWidthForWord(size - 1);
+
+  // Give each thread its own run of words, so that no two threads write the same word: count how many of each
+  // thread's share of the indices fall in each thread's words, lay the indices out by owning thread in one array
+  // and then have each thread set the bits of its own run of that array.
+  // (Thread u has the words from size * u / threadCount on.)
+  auto getOwner = [size, threadCount] (size_t index) -> size_t {
+    return ((index / bits + 1) * threadCount + size - 1) / size - 1;
+  };
+  std::vector<size_t> offsets(threadCount * threadCount + 1, 0);
+  parallel.pool.forEachChunk(threadCount, [&] (size_t t) {
+    for (_RandomAccessIterator i = begin + count * t / threadCount, iEnd = begin + count * (t + 1) / threadCount; i != iEnd; ++i) {
+      size_t owner = getOwner(static_cast<size_t>(*i));
+      DA(owner < threadCount);
+      ++offsets[owner * threadCount + t + 1];
+    }
+  });
+  for (size_t i = 1, iEnd = offsets.size(); i != iEnd; ++i) {
+    offsets[i] += offsets[i - 1];
+  }
+  std::vector<size_t> indices(count);
+  parallel.pool.forEachChunk(threadCount, [&] (size_t t) {
+    for (_RandomAccessIterator i = begin + count * t / threadCount, iEnd = begin + count * (t + 1) / threadCount; i != iEnd; ++i) {
+      size_t index = static_cast<size_t>(*i);
+      indices[offsets[getOwner(index) * threadCount + t]++] = index;
+    }
+  });
+  // (Each run's offsets have now each been moved on to the start of the next, so owner u's run is
+  // [offsets[u * threadCount - 1], offsets[(u + 1) * threadCount - 1]), with 0 for the first.)
+  word *b = o.b.data();
+  parallel.pool.forEachChunk(threadCount, [&] (size_t u) {
+    for (size_t i = u == 0 ? 0 : offsets[u * threadCount - 1], iEnd = offsets[(u + 1) * threadCount - 1]; i != iEnd; ++i) {
+      b[indices[i] / bits] |= one << (indices[i] % bits);
+    }
+  });
+  return o;
+}
+
+template<typename _Word> template<typename _RandomAccessIterator> BasicBitset<_Word> BasicBitset<_Word>::fromSortedIndices (_RandomAccessIterator begin, _RandomAccessIterator end, const Parallel &parallel) {
+  size_t count = static_cast<size_t>(end - begin);
+  if (count * sizeof(typename std::iterator_traits<_RandomAccessIterator>::value_type) < parallel.minBytes) {
+    return fromSortedIndices(begin, end);
+  }
+  BasicBitset o;
+  if (begin == end) {
+    return o;
+  }
+  o.ensureWidthForWord(static_cast<size_t>(end[-1]) / bits);
+
+  // Split the indices into runs that start on word boundaries, so that no two threads write the same word.
+  size_t threadCount = parallel.pool.getThreadCount();
+  std::vector<_RandomAccessIterator> splits(threadCount + 1, end);
+  splits[0] = begin;
+  for (size_t t = 1; t != threadCount; ++t) {
+    _RandomAccessIterator i = std::max(begin + count * t / threadCount, splits[t - 1]);
+    while (i != begin && i != end && static_cast<size_t>(*i) / bits == static_cast<size_t>(i[-1]) / bits) {
+      ++i;
+    }
+    splits[t] = i;
+  }
+  // (Get the words before starting the threads, as getting them may have to copy them.)
+  word *b = o.b.data();
+  parallel.pool.forEachChunk(threadCount, [&] (size_t t) {
+    setSortedIndices(b, splits[t], splits[t + 1]);
+  });
+  return o;
+}
+
+template<typename _Word> template<typename _ForwardIterator> void BasicBitset<_Word>::setSortedIndices (word *b, _ForwardIterator begin, _ForwardIterator end) noexcept {
+  // Gather the bits for each word before writing it.
+  while (begin != end) {
+    size_t wordI = static_cast<size_t>(*begin) / bits;
+    word w = 0;
+    for (; begin != end && static_cast<size_t>(*begin) / bits == wordI; ++begin) {
+      w |= one << (static_cast<size_t>(*begin) % bits);
+    }
+    b[wordI] |= w;
+  }
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  A lazily-evaluated logical expression over Bitsets. Building one (by calling lazy() and then applying |, & and
+  Bitset::andNot() to the result) does no work; converting it to a Bitset computes each word of the result in a
+  single pass over all of the operands, with one allocation. An expression refers to its operands, so it must be
+  evaluated before any of them is changed or destroyed.
+*/
+template<typename _Node> class BitsetExpr {
+  pub _Node node;
+
+  pub explicit BitsetExpr (const _Node &node);
+};
+
+/**
+  The expression that merges the nodes _L and _R (which are over the same word type) with _Merge.
+*/
+template<typename _Merge, typename _L, typename _R> using BitsetOpExpr = BitsetExpr<typename _L::Bitset::template OpNode<_Merge, _L, _R>>;
+
+template<typename _Word> BitsetExpr<typename BasicBitset<_Word>::LeafNode> lazy (const BasicBitset<_Word> &b) noexcept;
+template<typename _L, typename _R> BitsetOpExpr<typename _L::Bitset::OrMerge, _L, _R> operator| (const BitsetExpr<_L> &l, const BitsetExpr<_R> &r);
+template<typename _L> BitsetOpExpr<typename _L::Bitset::OrMerge, _L, typename _L::Bitset::LeafNode> operator| (const BitsetExpr<_L> &l, const typename _L::Bitset &r);
+template<typename _R> BitsetOpExpr<typename _R::Bitset::OrMerge, typename _R::Bitset::LeafNode, _R> operator| (const typename _R::Bitset &l, const BitsetExpr<_R> &r);
+template<typename _L, typename _R> BitsetOpExpr<typename _L::Bitset::AndMerge, _L, _R> operator& (const BitsetExpr<_L> &l, const BitsetExpr<_R> &r);
+template<typename _L> BitsetOpExpr<typename _L::Bitset::AndMerge, _L, typename _L::Bitset::LeafNode> operator& (const BitsetExpr<_L> &l, const typename _L::Bitset &r);
+template<typename _R> BitsetOpExpr<typename _R::Bitset::AndMerge, typename _R::Bitset::LeafNode, _R> operator& (const typename _R::Bitset &l, const BitsetExpr<_R> &r);
+
+template<typename _Word> struct BasicBitset<_Word>::LeafNode {
+  typedef BasicBitset Bitset;
+
+  const BasicBitset &b;
+
+  size_t getSize () const noexcept {
+    return b.b.size();
+  }
+
+  size_t getMinSize () const noexcept {
+    return b.b.size();
+  }
+
+  word getWord (size_t i) const noexcept {
+    return i < b.b.size() ? b.b[i] : 0;
+  }
+
+  word getWordWithinWidth (size_t i) const noexcept {
+    return b.b[i];
+  }
+};
+
+template<typename _Word> template<typename _Merge, typename _L, typename _R> struct BasicBitset<_Word>::OpNode {
+  typedef BasicBitset Bitset;
+
+  _L l;
+  _R r;
+
+  size_t getSize () const noexcept {
+    return _Merge::getSize(l.getSize(), r.getSize());
+  }
+
+  size_t getMinSize () const noexcept {
+    size_t lSize = l.getMinSize();
+    size_t rSize = r.getMinSize();
+    return lSize < rSize ? lSize : rSize;
+  }
+
+  word getWord (size_t i) const noexcept {
+    return _Merge::merge(l.getWord(i), r.getWord(i));
+  }
+
+  word getWordWithinWidth (size_t i) const noexcept {
+    return _Merge::merge(l.getWordWithinWidth(i), r.getWordWithinWidth(i));
+  }
+};
+
+template<typename _Word> struct BasicBitset<_Word>::OrMerge {
+  static size_t getSize (size_t lSize, size_t rSize) noexcept {
+    return lSize < rSize ? rSize : lSize;
+  }
+
+  static constexpr word merge (word v0, word v1) noexcept {
+    return v0 | v1;
+  }
+};
+
+template<typename _Word> struct BasicBitset<_Word>::AndMerge {
+  static size_t getSize (size_t lSize, size_t rSize) noexcept {
+    return lSize < rSize ? lSize : rSize;
+  }
+
+  static constexpr word merge (word v0, word v1) noexcept {
+    return v0 & v1;
+  }
+};
+
+template<typename _Word> struct BasicBitset<_Word>::AndNotMerge {
+  static size_t getSize (size_t lSize, size_t rSize) noexcept {
+    return lSize;
+  }
+
+  static constexpr word merge (word v0, word v1) noexcept {
+    return v0 & ~v1;
+  }
+};
+
+template<typename _Node> BitsetExpr<_Node>::BitsetExpr (const _Node &node) : node(node) {
+}
+
+template<typename _Word> BitsetExpr<typename BasicBitset<_Word>::LeafNode> lazy (const BasicBitset<_Word> &b) noexcept {
+  return BitsetExpr<typename BasicBitset<_Word>::LeafNode>(typename BasicBitset<_Word>::LeafNode{b});
+}
+
+template<typename _L, typename _R> BitsetOpExpr<typename _L::Bitset::OrMerge, _L, _R> operator| (const BitsetExpr<_L> &l, const BitsetExpr<_R> &r) {
+  return BitsetOpExpr<typename _L::Bitset::OrMerge, _L, _R>({l.node, r.node});
+}
+
+template<typename _L> BitsetOpExpr<typename _L::Bitset::OrMerge, _L, typename _L::Bitset::LeafNode> operator| (const BitsetExpr<_L> &l, const typename _L::Bitset &r) {
+  return l | lazy(r);
+}
+
+template<typename _R> BitsetOpExpr<typename _R::Bitset::OrMerge, typename _R::Bitset::LeafNode, _R> operator| (const typename _R::Bitset &l, const BitsetExpr<_R> &r) {
+  return lazy(l) | r;
+}
+
+template<typename _L, typename _R> BitsetOpExpr<typename _L::Bitset::AndMerge, _L, _R> operator& (const BitsetExpr<_L> &l, const BitsetExpr<_R> &r) {
+  return BitsetOpExpr<typename _L::Bitset::AndMerge, _L, _R>({l.node, r.node});
+}
+
+template<typename _L> BitsetOpExpr<typename _L::Bitset::AndMerge, _L, typename _L::Bitset::LeafNode> operator& (const BitsetExpr<_L> &l, const typename _L::Bitset &r) {
+  return l & lazy(r);
+}
+
+template<typename _R> BitsetOpExpr<typename _R::Bitset::AndMerge, typename _R::Bitset::LeafNode, _R> operator& (const typename _R::Bitset &l, const BitsetExpr<_R> &r) {
+  return lazy(l) & r;
+}
+
+template<typename _Word> template<typename _L, typename _R> BitsetExpr<typename BasicBitset<_Word>::template OpNode<typename BasicBitset<_Word>::AndNotMerge, _L, _R>> BasicBitset<_Word>::andNot (const BitsetExpr<_L> &l, const BitsetExpr<_R> &r) {
+  return BitsetExpr<OpNode<AndNotMerge, _L, _R>>({l.node, r.node});
+}
+
+template<typename _Word> template<typename _L> BitsetExpr<typename BasicBitset<_Word>::template OpNode<typename BasicBitset<_Word>::AndNotMerge, _L, typename BasicBitset<_Word>::LeafNode>> BasicBitset<_Word>::andNot (const BitsetExpr<_L> &l, const BasicBitset &r) {
+  return andNot(l, lazy(r));
+}
+
+template<typename _Word> template<typename _R> BitsetExpr<typename BasicBitset<_Word>::template OpNode<typename BasicBitset<_Word>::AndNotMerge, typename BasicBitset<_Word>::LeafNode, _R>> BasicBitset<_Word>::andNot (const BasicBitset &l, const BitsetExpr<_R> &r) {
+  return andNot(lazy(l), r);
+}
+
+template<typename _Word> template<typename _Node> BasicBitset<_Word>::BasicBitset (const BitsetExpr<_Node> &expr) : BasicBitset(expr.node.getSize(), false) {
+  const _Node &node = expr.node;
+  size_t size = b.size();
+  size_t nodeMinSize = node.getMinSize();
+  size_t i = 0;
+  for (size_t end = nodeMinSize < size ? nodeMinSize : size; i != end; ++i) {
+    b[i] = node.getWordWithinWidth(i);
+  }
+  for (; i != size; ++i) {
+    b[i] = node.getWord(i);
+  }
+  trim();
+}
+
+template<typename _Word> template<typename _Node> BasicBitset<_Word> &BasicBitset<_Word>::operator= (const BitsetExpr<_Node> &expr) {
+  return *this = BasicBitset(expr);
+}
+
+template<typename _Word> template<typename _InputIterator> BasicBitset<_Word> BasicBitset<_Word>::orAll (_InputIterator begin, _InputIterator end) {
+  std::vector<const BasicBitset *> bitsets;
+  for (; begin != end; ++begin) {
+    const BasicBitset &bitset = *begin;
+    bitsets.push_back(&bitset);
+  }
+  return orAllImpl(bitsets.data(), bitsets.size());
+}
+
+template<typename _Word> template<typename _Range> BasicBitset<_Word> BasicBitset<_Word>::orAll (const _Range &bitsets) {
+  return orAll(std::begin(bitsets), std::end(bitsets));
+}
+
+template<typename _Word> template<typename _InputIterator> BasicBitset<_Word> BasicBitset<_Word>::andAll (_InputIterator begin, _InputIterator end) {
+  std::vector<const BasicBitset *> bitsets;
+  for (; begin != end; ++begin) {
+    const BasicBitset &bitset = *begin;
+    bitsets.push_back(&bitset);
+  }
+  return andAllImpl(bitsets.data(), bitsets.size());
+}
+
+template<typename _Word> template<typename _Range> BasicBitset<_Word> BasicBitset<_Word>::andAll (const _Range &bitsets) {
+  return andAll(std::begin(bitsets), std::end(bitsets));
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  A bitset of a width fixed at compile time, held by value (so that small ones can live in registers) and with
+  constexpr operations whose loops over the words can be fully unrolled. Bits must be within the width.
+*/
+template<size_t _width> class FixedBitset {
+  prv typedef Bitset::word word;
+  prv static constexpr size_t bits = Bitset::bits;
+  prv static constexpr word one = 1;
+  prv static constexpr size_t wordCount = _width == 0 ? 1 : (_width + bits - 1) / bits;
+  prv typedef std::make_index_sequence<wordCount> WordIndices;
+  pub static constexpr size_t width = _width;
+  pub static constexpr size_t nonIndex = Bitset::nonIndex;
+
+  prv word w[wordCount];
+
+  pub constexpr FixedBitset () noexcept;
+  prv template<typename... _Words> constexpr explicit FixedBitset (bool, _Words... words) noexcept;
+  /**
+    Creates a FixedBitset from the bits of o that are within the width.
+  */
+  pub explicit FixedBitset (const Bitset &o) noexcept;
+  pub Bitset toBitset () const;
+
+  prv static constexpr iu getLowestSetBit (word w) noexcept;
+  pub constexpr void setBit (size_t i) noexcept;
+  pub constexpr void clearBit (size_t i) noexcept;
+  pub constexpr bool getBit (size_t i) const noexcept;
+  pub constexpr size_t getNextSetBit (size_t i) const noexcept;
+  prv template<size_t... _is> constexpr size_t getNextSetBit (size_t i, std::index_sequence<_is...>) const noexcept;
+  /**
+    Returns the mask of the bits of word wordI that are at or after bit i.
+  */
+  prv static constexpr word getMaskFrom (size_t wordI, size_t i) noexcept;
+  /**
+    Sets r_i to the index of the lowest set bit of w (taken to be word wordI), unless r_i is already set.
+  */
+  prv static constexpr void noteSetBit (size_t &r_i, size_t wordI, word w) noexcept;
+  pub constexpr void clear () noexcept;
+  pub constexpr bool empty () const noexcept;
+  prv template<size_t... _is> constexpr bool empty (std::index_sequence<_is...>) const noexcept;
+
+  prv template<typename _Merge, size_t... _is> static constexpr FixedBitset op (
+    const FixedBitset &l, const FixedBitset &r, std::index_sequence<_is...>
+  ) noexcept;
+  pub constexpr FixedBitset &operator|= (const FixedBitset &r) noexcept;
+  friend constexpr FixedBitset operator| (const FixedBitset &l, const FixedBitset &r) noexcept {
+    return op<Bitset::OrMerge>(l, r, WordIndices());
+  }
+  pub constexpr FixedBitset &operator&= (const FixedBitset &r) noexcept;
+  friend constexpr FixedBitset operator& (const FixedBitset &l, const FixedBitset &r) noexcept {
+    return op<Bitset::AndMerge>(l, r, WordIndices());
+  }
+  pub constexpr FixedBitset &andNot (const FixedBitset &r) noexcept;
+  pub static constexpr FixedBitset andNot (const FixedBitset &l, const FixedBitset &r) noexcept;
+  pub constexpr bool operator== (const FixedBitset &r) const noexcept;
+  prv template<size_t... _is> static constexpr bool equal (const FixedBitset &l, const FixedBitset &r, std::index_sequence<_is...>) noexcept;
+  pub constexpr bool operator!= (const FixedBitset &r) const noexcept;
+};
+
+template<size_t _width> constexpr FixedBitset<_width>::FixedBitset () noexcept : w{} {
+}
+
+template<size_t _width> template<typename... _Words> constexpr FixedBitset<_width>::FixedBitset (bool, _Words... words) noexcept : w{static_cast<word>(words)...} {
+}
+
+template<size_t _width> FixedBitset<_width>::FixedBitset (const Bitset &o) noexcept : w{} {
+  size_t size = o.b.size() < wordCount ? o.b.size() : wordCount;
+  std::copy(o.b.data(), o.b.data() + size, w);
+  if (_width % bits != 0) {
+    w[wordCount - 1] &= (one << (_width % bits)) - 1;
+  }
+}
+
+template<size_t _width> Bitset FixedBitset<_width>::toBitset () const {
+  Bitset o(wordCount, false);
+  std::copy(w, w + wordCount, &o.b[0]);
+  return o;
+}
+
+template<size_t _width> constexpr iu FixedBitset<_width>::getLowestSetBit (word w) noexcept {
+#ifdef __GNUC__
+  return static_cast<iu>(sizeof(word) <= sizeof(unsigned int) ? __builtin_ctz(w) : __builtin_ctzll(w));
+#else
+  iu i = 0;
+  for (; (w & 0b1) == 0; w >>= 1) {
+    ++i;
+  }
+  return i;
+#endif
+}
+
+template<size_t _width> constexpr void FixedBitset<_width>::setBit (size_t i) noexcept {
+  DPRE(i < _width);
+  w[i / bits] |= one << (i % bits);
+}
+
+template<size_t _width> constexpr void FixedBitset<_width>::clearBit (size_t i) noexcept {
+  DPRE(i < _width);
+  w[i / bits] &= ~(one << (i % bits));
+}
+
+template<size_t _width> constexpr bool FixedBitset<_width>::getBit (size_t i) const noexcept {
+  DPRE(i < _width);
+  return (w[i / bits] >> (i % bits)) & 0b1;
+}
+
+template<size_t _width> constexpr size_t FixedBitset<_width>::getNextSetBit (size_t i) const noexcept {
+  return getNextSetBit(i, WordIndices());
+}
+
+template<size_t _width> template<size_t... _is> constexpr size_t FixedBitset<_width>::getNextSetBit (size_t i, std::index_sequence<_is...>) const noexcept {
+  size_t o = nonIndex;
+  const int expansion[] = {(noteSetBit(o, _is, static_cast<word>(w[_is] & getMaskFrom(_is, i))), 0)...};
+  static_cast<void>(expansion);
+  return o;
+}
+
+template<size_t _width> constexpr typename FixedBitset<_width>::word FixedBitset<_width>::getMaskFrom (size_t wordI, size_t i) noexcept {
+  return wordI < i / bits ? 0 : wordI == i / bits ? static_cast<word>(~static_cast<word>(0) << (i % bits)) : ~static_cast<word>(0);
+}
+
+template<size_t _width> constexpr void FixedBitset<_width>::noteSetBit (size_t &r_i, size_t wordI, word w) noexcept {
+  if (r_i == nonIndex && w != 0) {
+    r_i = wordI * bits + getLowestSetBit(w);
+  }
+}
+
+template<size_t _width> constexpr void FixedBitset<_width>::clear () noexcept {
+  *this = FixedBitset();
+}
+
+template<size_t _width> constexpr bool FixedBitset<_width>::empty () const noexcept {
+  return empty(WordIndices());
+}
+
+template<size_t _width> template<size_t... _is> constexpr bool FixedBitset<_width>::empty (std::index_sequence<_is...>) const noexcept {
+  word any = 0;
+  const int expansion[] = {(any |= w[_is], 0)...};
+  static_cast<void>(expansion);
+  return any == 0;
+}
+
+template<size_t _width> template<typename _Merge, size_t... _is> constexpr FixedBitset<_width> FixedBitset<_width>::op (
+  const FixedBitset &l, const FixedBitset &r, std::index_sequence<_is...>
+) noexcept {
+  return FixedBitset(false, _Merge::merge(l.w[_is], r.w[_is])...);
+}
+
+template<size_t _width> constexpr FixedBitset<_width> &FixedBitset<_width>::operator|= (const FixedBitset &r) noexcept {
+  return *this = *this | r;
+}
+
+template<size_t _width> constexpr FixedBitset<_width> &FixedBitset<_width>::operator&= (const FixedBitset &r) noexcept {
+  return *this = *this & r;
+}
+
+template<size_t _width> constexpr FixedBitset<_width> &FixedBitset<_width>::andNot (const FixedBitset &r) noexcept {
+  return *this = andNot(*this, r);
+}
+
+template<size_t _width> constexpr FixedBitset<_width> FixedBitset<_width>::andNot (const FixedBitset &l, const FixedBitset &r) noexcept {
+  return op<Bitset::AndNotMerge>(l, r, WordIndices());
+}
+
+template<size_t _width> constexpr bool FixedBitset<_width>::operator== (const FixedBitset &r) const noexcept {
+  return equal(*this, r, WordIndices());
+}
+
+template<size_t _width> template<size_t... _is> constexpr bool FixedBitset<_width>::equal (const FixedBitset &l, const FixedBitset &r, std::index_sequence<_is...>) noexcept {
+  word diff = 0;
+  const int expansion[] = {(diff |= l.w[_is] ^ r.w[_is], 0)...};
+  static_cast<void>(expansion);
+  return diff == 0;
+}
+
+template<size_t _width> constexpr bool FixedBitset<_width>::operator!= (const FixedBitset &r) const noexcept {
+  return !(*this == r);
+}
+
+template<size_t _width> constexpr size_t FixedBitset<_width>::bits;
+template<size_t _width> constexpr typename FixedBitset<_width>::word FixedBitset<_width>::one;
+template<size_t _width> constexpr size_t FixedBitset<_width>::wordCount;
+template<size_t _width> constexpr size_t FixedBitset<_width>::width;
+template<size_t _width> constexpr size_t FixedBitset<_width>::nonIndex;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  A bitset over a 32-bit index space, split into chunks of 2^16 bits that are each stored as a sorted array of the
+  indices of the set bits, a plain bitmap or a list of runs (whichever is smallest), so that memory use follows
+  the contents rather than the highest index.
+*/
+class CompressedBitset {
+  pub static constexpr size_t nonIndex = Bitset::nonIndex;
+  pub static constexpr size_t maxIndex = 0xFFFFFFFF;
+  prv static constexpr size_t chunkBits = 1 << 16;
+  prv static constexpr size_t bitmapWords = chunkBits / 64;
+  prv static constexpr size_t maxArraySize = 4096;
+
+  prv struct Container {
+    enum class Type : iu8 {
+      ARRAY, BITMAP, RUN
+    };
+
+    Type type = Type::ARRAY;
+    /**
+      For ARRAY, the (sorted) indices of the set bits; for RUN, the first and last indices of each run, in order.
+    */
+    std::vector<iu16> values;
+    /**
+      For BITMAP, the bits.
+    */
+    std::vector<iu64> bitmap;
+    /**
+      For BITMAP, the number of bits set.
+    */
+    size_t cardinality = 0;
+
+    bool get (iu16 i) const noexcept;
+    void set (iu16 i);
+    void clear (iu16 i);
+    size_t getNext (size_t i) const noexcept;
+    iu16 getLast () const noexcept;
+    size_t count () const noexcept;
+    bool empty () const noexcept;
+    size_t findRun (iu16 i) const noexcept;
+    void getBitmap (std::vector<iu64> &r_bitmap) const;
+    void setBitmap (std::vector<iu64> &&bitmap);
+    void compact ();
+    static Container orOp (const Container &c0, const Container &c1);
+    static Container andOp (const Container &c0, const Container &c1);
+    static Container andNotOp (const Container &c0, const Container &c1);
+    bool operator== (const Container &r) const;
+  };
+
+  prv std::vector<iu16> keys;
+  prv std::vector<Container> containers;
+
+  pub CompressedBitset ();
+  pub explicit CompressedBitset (const Bitset &o);
+  pub Bitset toBitset () const;
+
+  prv size_t findContainer (iu16 key) const noexcept;
+  pub void setBit (size_t i);
+  pub void clearBit (size_t i);
+  pub bool getBit (size_t i) const noexcept;
+  pub size_t getNextSetBit (size_t i) const noexcept;
+  pub void clear () noexcept;
+  pub bool empty () const noexcept;
+  pub size_t count () const noexcept;
+  /**
+    Converts every chunk to its smallest representation (which the logical operations do for their results, but
+    which individual bit changes do not).
+  */
+  pub void compact ();
+
+  prv template<typename _ContainerOp> static CompressedBitset op (
+    const CompressedBitset &l, const CompressedBitset &r, bool keepL, bool keepR, _ContainerOp containerOp
   );
-  prv static void orOp (const core::string<word> &i0, size_t i0Size, const core::string<word> &i1, size_t i1Size, core::string<word> &r_o);
-  prv static void andOp (const core::string<word> &i0, const core::string<word> &i1, size_t iSize, core::string<word> &r_o);
-  prv static void andNotOp (const core::string<word> &i0, size_t i0Size, const core::string<word> &i1, size_t i1Size, core::string<word> &r_o);
-  pub Bitset &operator|= (Bitset &&r);
-  pub Bitset &operator|= (const Bitset &r);
-  friend Bitset operator| (Bitset &&l, Bitset &&r);
-  friend Bitset operator| (Bitset &&l, const Bitset &r);
-  friend Bitset operator| (const Bitset &l, Bitset &&r);
-  friend Bitset operator| (const Bitset &l, const Bitset &r);
-  pub Bitset &operator&= (Bitset &&r);
-  pub Bitset &operator&= (const Bitset &r);
-  friend Bitset operator& (Bitset &&l, Bitset &&r);
-  friend Bitset operator& (Bitset &&l, const Bitset &r);
-  friend Bitset operator& (const Bitset &l, Bitset &&r);
-  friend Bitset operator& (const Bitset &l, const Bitset &r);
-  pub Bitset &andNot (Bitset &&r);
-  pub Bitset &andNot (const Bitset &r);
-  pub static Bitset andNot (Bitset &&l, Bitset &&r);
-  pub static Bitset andNot (Bitset &&l, const Bitset &r);
-  pub static Bitset andNot (const Bitset &l, Bitset &&r);
-  pub static Bitset andNot (const Bitset &l, const Bitset &r);
-  pub bool operator== (const Bitset &r) const;
-  pub bool operator!= (const Bitset &r) const;
+  pub CompressedBitset &operator|= (const CompressedBitset &r);
+  friend CompressedBitset operator| (const CompressedBitset &l, const CompressedBitset &r);
+  pub CompressedBitset &operator&= (const CompressedBitset &r);
+  friend CompressedBitset operator& (const CompressedBitset &l, const CompressedBitset &r);
+  pub CompressedBitset &andNot (const CompressedBitset &r);
+  pub static CompressedBitset andNot (const CompressedBitset &l, const CompressedBitset &r);
+  pub bool operator== (const CompressedBitset &r) const;
+  pub bool operator!= (const CompressedBitset &r) const;
 };
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
+/**
+  A bitset whose bits can be set, cleared and tested by many threads at once, without locking. The words live in
+  segments of doubling size that are allocated on first use and never move, so growth does not disturb concurrent
+  access to the existing words. Each bit operation is atomic (and a read sees every change that happened before
+  the change to the word that it reads); a scan sees each word as it was at some point during the scan.
+*/
+class ConcurrentBitset {
+  prv typedef Bitset::word word;
+  prv static constexpr size_t bits = Bitset::bits;
+  prv static constexpr word one = 1;
+  /**
+    The size of the first segment; segment k holds firstSegmentWords << k words.
+  */
+  prv static constexpr size_t firstSegmentWords = 64;
+  prv static constexpr size_t maxSegmentCount = core::numeric_limits<size_t>::bits;
+  pub static constexpr size_t nonIndex = Bitset::nonIndex;
+
+  prv std::atomic<std::atomic<word> *> segments[maxSegmentCount];
+  /**
+    One more than the highest index of an allocated segment.
+  */
+  prv std::atomic<size_t> segmentCount;
+
+  pub ConcurrentBitset () noexcept;
+  /**
+    Creates a bitset whose words are allocated up front for bits [0, width).
+  */
+  pub explicit ConcurrentBitset (size_t width);
+  pub ConcurrentBitset (const ConcurrentBitset &o) = delete;
+  pub ConcurrentBitset &operator= (const ConcurrentBitset &o) = delete;
+  pub ~ConcurrentBitset () noexcept;
+
+  prv static size_t getSegment (size_t wordI, size_t &r_offset) noexcept;
+  prv static size_t getSegmentBegin (size_t segmentI) noexcept;
+  prv std::atomic<word> *getWord (size_t wordI) const noexcept;
+  prv std::atomic<word> &getOrCreateWord (size_t wordI);
+  pub void setBit (size_t i);
+  pub void clearBit (size_t i) noexcept;
+  /**
+    Sets (or clears) the bit, returning whether it was set before.
+  */
+  pub bool testAndSet (size_t i);
+  pub bool testAndClear (size_t i) noexcept;
+  pub bool getBit (size_t i) const noexcept;
+  prv template<typename _ReadOp, typename _AbsentResult> size_t getNextBit (size_t i, const _ReadOp &readOp, const _AbsentResult &absentResult) const noexcept;
+  pub size_t getNextSetBit (size_t i) const noexcept;
+  pub size_t getNextClearBit (size_t i) const noexcept;
+  /**
+    Returns a copy of the bits, with each word read atomically.
+  */
+  pub Bitset toBitset () const;
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  A read-only view of the words of a bitset that are held elsewhere: in a Bitset, or in a buffer such as a
+  memory-mapped file (which is then paged in only as its words are read). Nothing is copied, so the words must
+  outlive the view and must not change while it is in use. Operations between views (or a view and a Bitset,
+  which converts implicitly) produce Bitsets.
+*/
+class BitsetView {
+  prv typedef Bitset::word word;
+  prv static constexpr size_t bits = Bitset::bits;
+  pub static constexpr size_t nonIndex = Bitset::nonIndex;
+
+  prv const word *b;
+  prv size_t wordCount;
+
+  pub BitsetView () noexcept;
+  /**
+    Views the wordCount words at b, laid out as a Bitset's are.
+  */
+  pub BitsetView (const Bitset::word *b, size_t wordCount) noexcept;
+  pub BitsetView (const Bitset &o) noexcept;
+  pub Bitset toBitset () const;
+
+  pub const Bitset::word *getWords () const noexcept;
+  pub size_t getWordCount () const noexcept;
+  pub bool getBit (size_t i) const noexcept;
+  pub size_t getNextSetBit (size_t i) const noexcept;
+  pub size_t getNextClearBit (size_t i) const noexcept;
+  pub bool empty () const noexcept;
+  pub size_t count () const noexcept;
+
+  prv static Bitset orOp (const BitsetView &l, const BitsetView &r);
+  prv static Bitset andOp (const BitsetView &l, const BitsetView &r);
+  friend Bitset operator| (const BitsetView &l, const BitsetView &r) {
+    return orOp(l, r);
+  }
+  friend Bitset operator& (const BitsetView &l, const BitsetView &r) {
+    return andOp(l, r);
+  }
+  pub static Bitset andNot (const BitsetView &l, const BitsetView &r);
+  prv static bool equal (const BitsetView &l, const BitsetView &r) noexcept;
+  friend bool operator== (const BitsetView &l, const BitsetView &r) noexcept {
+    return equal(l, r);
+  }
+  friend bool operator!= (const BitsetView &l, const BitsetView &r) noexcept {
+    return !(l == r);
+  }
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  The serialized form of a bitset is the same on every host. It is made of little-endian 64-bit units: a header of
+  two units (the magic number in bytes 0-3, the format version in bytes 4-5 and the flags in bytes 6-7; then the
+  number of payload units), the payload (with bit i in bit i % 64 of unit i / 64) and, if the checksum flag is
+  set, a checksum of the payload. Every unit is 8-byte aligned, so on a little-endian host a mapped file can be
+  used in place, as a BitsetView.
+*/
+class BitsetFormat {
+  prv typedef Bitset::word word;
+  friend class BitsetWriter;
+  friend class BitsetReader;
+
+  pub static constexpr iu32 magic = 0x54455342; // "BSET"
+  pub static constexpr iu16 version = 1;
+  pub static constexpr iu16 checksumFlag = 0b1;
+  pub static constexpr size_t unitSize = 8;
+  pub static constexpr size_t headerSize = 2 * unitSize;
+  /**
+    The size of the buffers that the writer and reader stream through.
+  */
+  prv static constexpr size_t bufferSize = 4096;
+  static_assert(unitSize % sizeof(word) == 0, "a unit must hold a whole number of words");
+
+  prv static size_t getUnitCount (size_t wordCount) noexcept;
+  prv static iu64 loadUnit (const iu8 *b) noexcept;
+  prv static void storeUnit (iu64 u, iu8 *r_o) noexcept;
+  /**
+    Reads the header at b, returning false if it is not that of a bitset of a version that this can read (or one
+    too big to address).
+  */
+  prv static bool parseHeader (const iu8 *b, iu64 &r_unitCount, bool &r_checksummed) noexcept;
+  prv static iu64 startChecksum (iu64 unitCount) noexcept;
+  prv static iu64 addToChecksum (iu64 checksum, const iu8 *b, size_t size) noexcept;
+  prv static void storeWords (const word *b, size_t size, iu8 *r_o) noexcept;
+  prv static void loadWords (const iu8 *b, size_t size, word *r_o) noexcept;
+
+  /**
+    Sets r_o to view the payload of the serialized bitset occupying the size bytes at b (e.g. a mapped file),
+    returning false if they do not hold one or it cannot be viewed in place (i.e. the host is big-endian or b is
+    misaligned). The checksum is not checked, since that would mean reading the whole payload.
+  */
+  pub static bool view (const void *b, size_t size, BitsetView &r_o) noexcept;
+};
+
+/**
+  Writes a serialized bitset to a stream, a buffer at a time, from words supplied in any number of pieces.
+*/
+class BitsetWriter {
+  prv typedef Bitset::word word;
+
+  prv std::ostream &out;
+  prv size_t wordCount;
+  prv size_t writtenCount;
+  prv bool checksummed;
+  prv iu64 checksum;
+  prv size_t bufferUsed;
+  prv iu8 buffer[BitsetFormat::bufferSize];
+
+  /**
+    Writes the header of a bitset of wordCount words (rounded up to whole units).
+  */
+  pub BitsetWriter (std::ostream &out, size_t wordCount, bool checksummed = true);
+  pub BitsetWriter (const BitsetWriter &o) = delete;
+  pub BitsetWriter &operator= (const BitsetWriter &o) = delete;
+
+  prv void flush ();
+  /**
+    Writes the next size words of the payload.
+  */
+  pub void write (const Bitset::word *b, size_t size);
+  /**
+    Writes zeros for any words not yet written, then the checksum, returning whether the stream is still good.
+  */
+  pub bool finish ();
+
+  /**
+    Writes the whole of bitset, leaving out its trailing zero words if trim.
+  */
+  pub static bool write (std::ostream &out, const BitsetView &bitset, bool trim = true, bool checksummed = true);
+};
+
+/**
+  Reads a serialized bitset from a stream, a buffer at a time, into words supplied in any number of pieces.
+*/
+class BitsetReader {
+  prv typedef Bitset::word word;
+
+  prv std::istream &in;
+  prv size_t wordCount;
+  prv size_t readCount;
+  /**
+    The number of bytes of the payload not yet read from the stream.
+  */
+  prv size_t unreadSize;
+  prv bool checksummed;
+  prv iu64 checksum;
+  prv size_t bufferUsed;
+  prv size_t bufferFilled;
+  prv iu8 buffer[BitsetFormat::bufferSize];
+
+  pub explicit BitsetReader (std::istream &in) noexcept;
+  pub BitsetReader (const BitsetReader &o) = delete;
+  pub BitsetReader &operator= (const BitsetReader &o) = delete;
+
+  /**
+    Reads the header, returning false if the stream does not hold a bitset of a version that this can read.
+  */
+  pub bool open ();
+  /**
+    Returns the number of words in the payload (once open).
+  */
+  pub size_t getWordCount () const noexcept;
+  prv bool fill ();
+  /**
+    Reads the next size words of the payload into r_o, returning false if the stream fails.
+  */
+  pub bool read (Bitset::word *r_o, size_t size);
+  /**
+    Reads the rest of the payload and the checksum, returning false if the stream fails or the checksum does not
+    match.
+  */
+  pub bool finish ();
+
+  pub static bool read (std::istream &in, Bitset &r_o);
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  Evaluates operations over bitsets serialized in streams (e.g. files) a chunk at a time, so that neither the
+  operands nor the result need fit in memory. The next chunks of the operands are read on a thread of its own while
+  the current ones are merged. The results are those of the Bitset operations, except that they are not trimmed.
+  Only the words that the operation needs are read (so the checksum of an operand is checked only if all of its
+  words are needed). On failure, some of the result may already have gone to the sink.
+*/
+class BitsetStream {
+  prv typedef Bitset::word word;
+  prv enum class Kind { OR, AND, AND_NOT };
+  /**
+    Receives the words of the result in order, a chunk at a time. It must not throw.
+  */
+  pub typedef std::function<void (const Bitset::word *b, size_t size)> Sink;
+  pub static constexpr size_t defaultChunkSize = 1 << 20;
+
+  prv static size_t merge (Kind kind, const word *l, size_t lSize, const word *r, size_t rSize, word *r_o) noexcept;
+  /**
+    Calls begin with the size of the result in words, then passes the result to sink, returning false if either
+    operand cannot be read.
+  */
+  prv static bool run (
+    std::istream &l, std::istream &r, Kind kind, size_t chunkSize,
+    const std::function<void (size_t size)> &begin, const Sink &sink
+  );
+  prv static bool run (std::istream &l, std::istream &r, Kind kind, size_t chunkSize, std::ostream &out, bool checksummed);
+  prv static bool count (std::istream &l, std::istream &r, Kind kind, size_t chunkSize, size_t &r_count);
+  /**
+    Passes the result to sink, or serializes it to out (returning false if out fails).
+  */
+  pub static bool orOp (std::istream &l, std::istream &r, const Sink &sink, size_t chunkSize = defaultChunkSize);
+  pub static bool orOp (std::istream &l, std::istream &r, std::ostream &out, bool checksummed = true, size_t chunkSize = defaultChunkSize);
+  pub static bool andOp (std::istream &l, std::istream &r, const Sink &sink, size_t chunkSize = defaultChunkSize);
+  pub static bool andOp (std::istream &l, std::istream &r, std::ostream &out, bool checksummed = true, size_t chunkSize = defaultChunkSize);
+  pub static bool andNot (std::istream &l, std::istream &r, const Sink &sink, size_t chunkSize = defaultChunkSize);
+  pub static bool andNot (std::istream &l, std::istream &r, std::ostream &out, bool checksummed = true, size_t chunkSize = defaultChunkSize);
+  /**
+    Sets r_count to the number of set bits in the result, without writing it out.
+  */
+  pub static bool orCount (std::istream &l, std::istream &r, size_t &r_count, size_t chunkSize = defaultChunkSize);
+  pub static bool andCount (std::istream &l, std::istream &r, size_t &r_count, size_t chunkSize = defaultChunkSize);
+  pub static bool andNotCount (std::istream &l, std::istream &r, size_t &r_count, size_t chunkSize = defaultChunkSize);
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+namespace std {
+
+template<typename _Word> struct hash<bitset::BasicBitset<_Word>> {
+  size_t operator() (const bitset::BasicBitset<_Word> &b) const noexcept {
+    return b.hash();
+  }
+};
+
 }
 
 #endif
@@ -1,14 +1,51 @@
 #include "header.hpp"
 #include <vector>
 #include <algorithm>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <unordered_set>
 
 using std::fill;
 using std::copy;
 using std::vector;
 using bitset::Bitset;
+using bitset::BasicBitset;
+using bitset::CompressedBitset;
+using bitset::lazy;
+using bitset::FixedBitset;
+using bitset::ConcurrentBitset;
+using bitset::BitsetView;
+using bitset::BitsetFormat;
+using bitset::BitsetWriter;
+using bitset::BitsetReader;
+using bitset::BitsetStream;
+using bitset::WordAllocator;
+using bitset::AllocatorScope;
+using bitset::MonotonicArena;
+using bitset::PoolAllocator;
+using bitset::ThreadPool;
+using bitset::Parallel;
+using std::set;
+using std::set_union;
+using std::set_intersection;
+using std::set_difference;
+using std::inserter;
+using std::next;
 using std::move;
+using std::swap;
 using core::check;
 using std::all_of;
+using std::max;
+using std::find;
+using std::thread;
+using std::atomic;
+using std::string;
+using std::stringstream;
+using std::unordered_set;
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
@@ -20,6 +57,17 @@ int main (int argc, char *argv[]) {
   bitset::DOPEN(, errs);*/
 
   testBitsets();
+  testWideBitsets();
+  testCompressedBitsets();
+  testFixedBitsets();
+  testConcurrentBitsets();
+  testBitsetViews();
+  testSerialization();
+  testBitsetStreams();
+  testAllocators();
+  testSharedBitsets();
+  testTrimPolicies();
+  testHashingAndOrdering();
 
   return 0;
 }
@@ -260,6 +308,1490 @@ void testBitsets () {
       check(j == k, bitset0 == bitset1);
     }
   }
+
+  // Once refreshed, indexed bitsets can be read from several threads at once.
+  Bitset shared;
+  for (size_t i = 0; i < 200000; i += 3) {
+    shared.setBit(i);
+  }
+  shared.enableRankIndex();
+  shared.refreshRankIndex();
+  shared.enableSummaryIndex();
+  shared.refreshSummaryIndex();
+  const Bitset &reader = shared;
+  vector<thread> readers;
+  for (iu t = 0; t != 4; ++t) {
+    readers.emplace_back([&reader, t] () {
+      for (size_t i = t; i < 200000; i += 997) {
+        check((i + 2) / 3, reader.rank(i));
+        check(i % 1000 * 3, reader.select(i % 1000));
+        check((i + 2) / 3 * 3, reader.getNextSetBit(i));
+        check(i % 3 == 0 ? i + 1 : i, reader.getNextClearBit(i));
+      }
+    });
+  }
+  for (thread &t : readers) {
+    t.join();
+  }
+
+  // Bitsets without indexes can be read from several threads at once as they are (even with the hash cache).
+  Bitset combinedCopy = shared | Bitset(500000);
+  combinedCopy.enableHashCache();
+  const Bitset combined = move(combinedCopy);
+  readers.clear();
+  for (iu t = 0; t != 4; ++t) {
+    readers.emplace_back([&combined, &reader] () {
+      check(reader.hash(), combined.hash());
+      check(false, combined.empty());
+      check(true, combined == reader);
+      check(199998, combined.getHighestSetBit());
+    });
+  }
+  for (thread &t : readers) {
+    t.join();
+  }
+}
+
+vector<bool> createWideRep (size_t width, iu density, iu32 &r_seed) {
+  vector<bool> rep(width);
+  for (size_t i = 0; i != width; ++i) {
+    r_seed = r_seed * 1103515245 + 12345;
+    rep[i] = (r_seed >> 16) % 100 < density;
+  }
+  return rep;
+}
+
+template<typename _Bitset> _Bitset createWideBitset (const vector<bool> &rep) {
+  _Bitset bitset;
+  for (size_t i = 0; i != rep.size(); ++i) {
+    if (rep[i]) {
+      bitset.setBit(i);
+    }
+  }
+  return bitset;
+}
+
+template<typename _Bitset> void testWideBitsets () {
+  static const size_t widths[] = {
+    0, 1, 31, 32, 33, 127, 128, 129, 255, 256, 257, 511, 512, 513, 1000, 4133
+  };
+  vector<vector<bool>> reps;
+  vector<_Bitset> bitsets;
+  iu32 seed = 1;
+  for (size_t width : widths) {
+    for (iu density : {0, 3, 50, 100}) {
+      reps.emplace_back(createWideRep(width, density, seed));
+      bitsets.emplace_back(createWideBitset<_Bitset>(reps.back()));
+    }
+  }
+
+  for (size_t j = 0; j != reps.size(); ++j) {
+    const vector<bool> &rep = reps[j];
+    const _Bitset &bitset = bitsets[j];
+
+    check(find(rep.begin(), rep.end(), true) == rep.end(), bitset.empty());
+    size_t nextSet = _Bitset::nonIndex;
+    size_t nextClear = rep.size();
+    for (size_t i = rep.size() - 1; i != static_cast<size_t>(0) - 1; --i) {
+      if (rep[i]) {
+        nextSet = i;
+      } else {
+        nextClear = i;
+      }
+      check(nextSet, bitset.getNextSetBit(i));
+      check(nextClear, bitset.getNextClearBit(i) < rep.size() ? bitset.getNextClearBit(i) : rep.size());
+    }
+    size_t prevSet = _Bitset::nonIndex;
+    size_t prevClear = _Bitset::nonIndex;
+    for (size_t i = 0; i != rep.size(); ++i) {
+      if (rep[i]) {
+        prevSet = i;
+      } else {
+        prevClear = i;
+      }
+      check(prevSet, bitset.getPrevSetBit(i));
+      check(prevClear, bitset.getPrevClearBit(i));
+    }
+    check(prevSet, bitset.getHighestSetBit());
+    check(prevSet, bitset.getPrevSetBit(rep.size() + 500));
+    check(rep.size() + 500, bitset.getPrevClearBit(rep.size() + 500));
+    check(_Bitset::nonIndex, bitset.getPrevSetBit(_Bitset::nonIndex));
+    check(_Bitset::nonIndex, bitset.getPrevClearBit(_Bitset::nonIndex));
+
+    vector<size_t> indices;
+    for (size_t i = 0; i != rep.size(); ++i) {
+      if (rep[i]) {
+        indices.push_back(i);
+      }
+    }
+    vector<size_t> iterated;
+    for (size_t i : bitset.setBits()) {
+      iterated.push_back(i);
+    }
+    check(indices, iterated);
+    iterated.clear();
+    bitset.forEachSetBit([&] (size_t i) {
+      iterated.push_back(i);
+    });
+    check(indices, iterated);
+    iterated.clear();
+    for (size_t i : bitset.setBitsInReverse()) {
+      iterated.push_back(i);
+    }
+    check(vector<size_t>(indices.rbegin(), indices.rend()), iterated);
+    vector<iu32> decoded(bitset.count() + 1, 7);
+    check(indices.size(), bitset.decode(decoded.data()));
+    check(7, decoded.back());
+    decoded.pop_back();
+    check(vector<iu32>(indices.begin(), indices.end()), decoded);
+
+    ThreadPool pool3(3), pool1(1);
+    check(bitset, _Bitset::fromSortedIndices(indices.begin(), indices.end()));
+    check(bitset, _Bitset::fromSortedIndices(indices.begin(), indices.end(), Parallel(pool3, 0)));
+    vector<size_t> shuffled = indices;
+    for (size_t i = 1; i < shuffled.size(); ++i) {
+      seed = seed * 1103515245 + 12345;
+      swap(shuffled[i], shuffled[(seed >> 8) % (i + 1)]);
+    }
+    if (!shuffled.empty()) {
+      shuffled.push_back(shuffled[0]);
+    }
+    check(bitset, _Bitset::fromIndices(shuffled.begin(), shuffled.end()));
+    check(bitset, _Bitset::fromIndices(shuffled.begin(), shuffled.end(), Parallel(pool3, 0)));
+    check(bitset, _Bitset::fromIndices(shuffled.begin(), shuffled.end(), Parallel(pool1, 0)));
+
+    for (bool indexed : {false, true}) {
+      _Bitset b = bitset;
+      vector<bool> r = rep;
+      if (indexed) {
+        b.enableRankIndex();
+      }
+      for (iu pass = 0; pass != 2; ++pass) {
+        size_t rank = 0;
+        for (size_t i = 0; i != r.size(); ++i) {
+          check(rank, b.rank(i));
+          if (r[i]) {
+            check(i, b.select(rank));
+            ++rank;
+          }
+        }
+        check(rank, b.count());
+        check(rank, b.rank(r.size() + 1000));
+        check(_Bitset::nonIndex, b.select(rank));
+
+        // Change the bitset, to check that the index follows.
+        for (size_t i = r.size() / 3; i < r.size(); i += 7) {
+          r[i] = !r[i];
+          if (r[i]) {
+            b.setBit(i);
+          } else {
+            b.clearBit(i);
+          }
+        }
+      }
+      b |= bitsets[(j + 5) % bitsets.size()];
+      check(b.count(), b.rank(b.count() * 100 + 5000));
+      b = _Bitset::andNot(b, bitset);
+      check(b.count(), b.rank(b.count() * 100 + 5000));
+      for (size_t k = 0; k != b.count(); ++k) {
+        check(k, b.rank(b.select(k)));
+      }
+    }
+
+    {
+      _Bitset b = bitset;
+      vector<bool> r = rep;
+      b.enableSummaryIndex();
+      for (iu pass = 0; pass != 3; ++pass) {
+        check(find(r.begin(), r.end(), true) == r.end(), b.empty());
+        size_t nextSet = _Bitset::nonIndex;
+        size_t nextClear = r.size();
+        for (size_t i = r.size() - 1; i != static_cast<size_t>(0) - 1; --i) {
+          if (r[i]) {
+            nextSet = i;
+          } else {
+            nextClear = i;
+          }
+          check(nextSet, b.getNextSetBit(i));
+          check(nextClear, b.getNextClearBit(i) < r.size() ? b.getNextClearBit(i) : r.size());
+        }
+        check(_Bitset::nonIndex, b.getNextSetBit(r.size() + 1000));
+        check(r.size() + 1000, b.getNextClearBit(r.size() + 1000));
+
+        // Change single bits (which update the summary in place), then whole words (which invalidate it).
+        for (size_t i = r.size() / 4; i < r.size(); i += 13) {
+          r[i] = !r[i];
+          if (r[i]) {
+            b.setBit(i);
+          } else {
+            b.clearBit(i);
+          }
+        }
+        if (pass == 1) {
+          for (size_t i = 0; i != r.size(); ++i) {
+            r[i] = false;
+          }
+          b.clear();
+          r.resize(r.size() + 5000, false);
+          r.back() = true;
+          b.setBit(r.size() - 1);
+        }
+      }
+      _Bitset plain = b;
+      plain.disableSummaryIndex();
+      b.clearBit(r.size() - 1);
+      plain.clearBit(r.size() - 1);
+      b.compact();
+      plain.compact();
+      check(plain, b);
+      check(plain.empty(), b.empty());
+      check(plain.getNextSetBit(0), b.getNextSetBit(0));
+
+      b = bitset;
+      b.enableSummaryIndex();
+      check(bitset.empty(), b.empty());
+      b |= bitsets[(j + 5) % bitsets.size()];
+      check(bitset | bitsets[(j + 5) % bitsets.size()], b);
+      plain = b;
+      plain.disableSummaryIndex();
+      for (size_t i = 0; i < r.size() + 64; i += 3) {
+        check(plain.getNextSetBit(i), b.getNextSetBit(i));
+        check(plain.getNextClearBit(i), b.getNextClearBit(i));
+      }
+    }
+  }
+
+  auto checkOp = [] (const vector<bool> &r0, const vector<bool> &r1, const _Bitset &res, bool (*mergeOp) (bool, bool)) {
+    size_t width = max(r0.size(), r1.size());
+    for (size_t i = 0; i != width + 1; ++i) {
+      bool v0 = i < r0.size() && r0[i];
+      bool v1 = i < r1.size() && r1[i];
+      check(mergeOp(v0, v1), res.getBit(i));
+    }
+  };
+  auto orOp = [] (bool v0, bool v1) -> bool {
+    return v0 || v1;
+  };
+  auto andOp = [] (bool v0, bool v1) -> bool {
+    return v0 && v1;
+  };
+  auto andNotOp = [] (bool v0, bool v1) -> bool {
+    return v0 && !v1;
+  };
+  for (size_t j = 0; j != reps.size(); ++j) {
+    const vector<bool> &rep0 = reps[j];
+    const _Bitset &bitset0 = bitsets[j];
+    for (size_t k = 0; k != reps.size(); ++k) {
+      const vector<bool> &rep1 = reps[k];
+      const _Bitset &bitset1 = bitsets[k];
+
+      {
+        _Bitset b = bitset0;
+        b |= bitset1;
+        checkOp(rep0, rep1, b, orOp);
+      }
+      {
+        _Bitset b = bitset0;
+        b |= _Bitset(bitset1);
+        checkOp(rep0, rep1, b, orOp);
+        _Bitset::assignOr(b, bitset0, bitset1);
+        checkOp(rep0, rep1, b, orOp);
+        b = bitset0;
+        _Bitset::assignOr(b, b, bitset1);
+        checkOp(rep0, rep1, b, orOp);
+        b = bitset1;
+        _Bitset::assignOr(b, bitset0, b);
+        checkOp(rep0, rep1, b, orOp);
+      }
+      checkOp(rep0, rep1, bitset0 | bitset1, orOp);
+      checkOp(rep0, rep1, _Bitset(bitset0) | bitset1, orOp);
+      checkOp(rep0, rep1, bitset0 | _Bitset(bitset1), orOp);
+      checkOp(rep0, rep1, _Bitset(bitset0) | _Bitset(bitset1), orOp);
+
+      {
+        _Bitset b = bitset0;
+        b &= bitset1;
+        checkOp(rep0, rep1, b, andOp);
+      }
+      {
+        _Bitset b = bitset0;
+        b &= _Bitset(bitset1);
+        checkOp(rep0, rep1, b, andOp);
+        _Bitset::assignAnd(b, bitset0, bitset1);
+        checkOp(rep0, rep1, b, andOp);
+        b = bitset0;
+        _Bitset::assignAnd(b, b, bitset1);
+        checkOp(rep0, rep1, b, andOp);
+        b = bitset1;
+        _Bitset::assignAnd(b, bitset0, b);
+        checkOp(rep0, rep1, b, andOp);
+      }
+      checkOp(rep0, rep1, bitset0 & bitset1, andOp);
+      checkOp(rep0, rep1, _Bitset(bitset0) & bitset1, andOp);
+      checkOp(rep0, rep1, bitset0 & _Bitset(bitset1), andOp);
+      checkOp(rep0, rep1, _Bitset(bitset0) & _Bitset(bitset1), andOp);
+
+      {
+        _Bitset b = bitset0;
+        b.andNot(bitset1);
+        checkOp(rep0, rep1, b, andNotOp);
+      }
+      {
+        _Bitset b = bitset0;
+        b.andNot(_Bitset(bitset1));
+        checkOp(rep0, rep1, b, andNotOp);
+        _Bitset::assignAndNot(b, bitset0, bitset1);
+        checkOp(rep0, rep1, b, andNotOp);
+        b = bitset0;
+        _Bitset::assignAndNot(b, b, bitset1);
+        checkOp(rep0, rep1, b, andNotOp);
+        b = bitset1;
+        _Bitset::assignAndNot(b, bitset0, b);
+        checkOp(rep0, rep1, b, andNotOp);
+      }
+      checkOp(rep0, rep1, _Bitset::andNot(bitset0, bitset1), andNotOp);
+      checkOp(rep0, rep1, _Bitset::andNot(_Bitset(bitset0), bitset1), andNotOp);
+      checkOp(rep0, rep1, _Bitset::andNot(bitset0, _Bitset(bitset1)), andNotOp);
+      checkOp(rep0, rep1, _Bitset::andNot(_Bitset(bitset0), _Bitset(bitset1)), andNotOp);
+
+      auto xorOp = [] (bool v0, bool v1) -> bool {
+        return v0 != v1;
+      };
+      {
+        _Bitset b = bitset0;
+        b ^= bitset1;
+        checkOp(rep0, rep1, b, xorOp);
+        b = bitset0;
+        b ^= _Bitset(bitset1);
+        checkOp(rep0, rep1, b, xorOp);
+      }
+      checkOp(rep0, rep1, bitset0 ^ bitset1, xorOp);
+      checkOp(rep0, rep1, _Bitset(bitset0) ^ bitset1, xorOp);
+      checkOp(rep0, rep1, bitset0 ^ _Bitset(bitset1), xorOp);
+      checkOp(rep0, rep1, _Bitset(bitset0) ^ _Bitset(bitset1), xorOp);
+
+      bool equal = true;
+      for (size_t i = 0, width = max(rep0.size(), rep1.size()); i != width; ++i) {
+        if ((i < rep0.size() && rep0[i]) != (i < rep1.size() && rep1[i])) {
+          equal = false;
+          break;
+        }
+      }
+      check(equal, bitset0 == bitset1);
+
+      size_t andCount = 0;
+      size_t orCount = 0;
+      size_t andNotCount = 0;
+      for (size_t i = 0, width = max(rep0.size(), rep1.size()); i != width; ++i) {
+        bool v0 = i < rep0.size() && rep0[i];
+        bool v1 = i < rep1.size() && rep1[i];
+        andCount += v0 && v1;
+        orCount += v0 || v1;
+        andNotCount += v0 && !v1;
+      }
+      check(andCount, _Bitset::andCount(bitset0, bitset1));
+      check(orCount, _Bitset::orCount(bitset0, bitset1));
+      check(andNotCount, _Bitset::andNotCount(bitset0, bitset1));
+      check(andCount != 0, _Bitset::intersects(bitset0, bitset1));
+      check(andCount == 0, _Bitset::isDisjoint(bitset0, bitset1));
+      check(andNotCount == 0, _Bitset::isSubsetOf(bitset0, bitset1));
+      check(orCount == 0 ? 1 : static_cast<double>(andCount) / static_cast<double>(orCount), _Bitset::jaccard(bitset0, bitset1));
+    }
+  }
+
+  for (size_t j = 0; j < reps.size(); j += 3) {
+    const _Bitset &a = bitsets[j];
+    const _Bitset &b = bitsets[(j * 7 + 1) % bitsets.size()];
+    const _Bitset &c = bitsets[(j * 13 + 2) % bitsets.size()];
+    const _Bitset &d = bitsets[(j * 5 + 3) % bitsets.size()];
+
+    check(a | b | (c & d), _Bitset(lazy(a) | b | (lazy(c) & d)));
+    check(_Bitset::andNot(_Bitset::andNot(a, b), c), _Bitset(_Bitset::andNot(_Bitset::andNot(lazy(a), b), c)));
+    check(_Bitset::andNot(a | b, c & d), _Bitset(_Bitset::andNot(a | lazy(b), c & lazy(d))));
+    _Bitset e = a;
+    e = lazy(e) & b;
+    check(a & b, e);
+
+    vector<_Bitset> operands = {a, b, c, d};
+    check(a | b | c | d, _Bitset::orAll(operands));
+    check(a & b & c & d, _Bitset::andAll(operands));
+    check(b | c, _Bitset::orAll(operands.begin() + 1, operands.begin() + 3));
+    check(_Bitset(), _Bitset::andAll(operands.begin(), operands.begin()));
+  }
+  {
+    vector<_Bitset> operands(5);
+    for (size_t j = 0; j != operands.size(); ++j) {
+      for (size_t i = j; i < 200000 + j * 10000; i += j + 3) {
+        operands[j].setBit(i);
+      }
+    }
+    _Bitset orResult = operands[0];
+    _Bitset andResult = operands[0];
+    for (const _Bitset &operand : operands) {
+      orResult |= operand;
+      andResult &= operand;
+    }
+    check(orResult, _Bitset::orAll(operands));
+    check(andResult, _Bitset::andAll(operands));
+
+    for (size_t j = 0; j + 1 != operands.size(); ++j) {
+      const _Bitset &l = operands[j];
+      const _Bitset &r = operands[j + 1];
+      check((l & r).count(), _Bitset::andCount(l, r));
+      check((l | r).count(), _Bitset::orCount(l, r));
+      check(_Bitset::andNot(l, r).count(), _Bitset::andNotCount(l, r));
+      check(!(l & r).empty(), _Bitset::intersects(l, r));
+      check(true, _Bitset::isSubsetOf(l & r, r));
+      check(_Bitset::andNot(l, r).empty(), _Bitset::isSubsetOf(l, r));
+    }
+    ThreadPool pool(3);
+    Parallel parallel(pool, 0);
+    vector<_Bitset> bigOperands(3);
+    for (size_t j = 0; j != bigOperands.size(); ++j) {
+      for (size_t i = j; i < 4000000 + j * 1000000; i += j * 5 + 3) {
+        bigOperands[j].setBit(i);
+      }
+    }
+    for (const Parallel &p : {parallel, Parallel(pool)}) {
+      for (size_t j = 0; j != bigOperands.size(); ++j) {
+        const _Bitset &l = bigOperands[j];
+        const _Bitset &r = bigOperands[(j + 1) % bigOperands.size()];
+        _Bitset o;
+        _Bitset::assignOr(o, l, r, p);
+        check(l | r, o);
+        _Bitset::assignAnd(o, l, r, p);
+        check(l & r, o);
+        _Bitset::assignAndNot(o, l, r, p);
+        check(_Bitset::andNot(l, r), o);
+        o = l;
+        _Bitset::assignOr(o, o, r, p);
+        check(l | r, o);
+        check(l.count(), l.count(p));
+        check(false, l.empty(p));
+        check(true, _Bitset(l.count() * 10).empty(p));
+        check(true, _Bitset::equal(l, _Bitset(l), p));
+        check(false, _Bitset::equal(l, r, p));
+        _Bitset longer = l;
+        longer.ensureWidth(l.count() * 20);
+        check(true, _Bitset::equal(l, longer, p));
+        longer.setBit(l.count() * 20 - 1);
+        check(false, _Bitset::equal(longer, l, p));
+      }
+    }
+
+    _Bitset late;
+    late.setBit(150000);
+    check(false, _Bitset::isDisjoint(late, operands[0] | late));
+    check(true, _Bitset::isSubsetOf(late, operands[0] | late));
+    check(false, _Bitset::isSubsetOf(operands[0] | late, late));
+  }
+
+  for (size_t j = 0; j != reps.size(); ++j) {
+    const vector<bool> &rep = reps[j];
+    const _Bitset &bitset = bitsets[j];
+
+    for (size_t width : {static_cast<size_t>(0), static_cast<size_t>(1), rep.size() / 2, rep.size() + 40}) {
+      _Bitset flipped = _Bitset::flip(bitset, width);
+      for (size_t i = 0; i != max(width, rep.size()) + 1; ++i) {
+        check((i < rep.size() && rep[i]) != (i < width), flipped.getBit(i));
+      }
+      check(bitset, _Bitset::flip(_Bitset(flipped), width));
+      flipped.flip(width);
+      check(bitset, flipped);
+    }
+
+    for (size_t k : {0, 1, 5, 31, 32, 33, 64, 100, 1000}) {
+      _Bitset left = bitset << k;
+      _Bitset right = bitset >> k;
+      for (size_t i = 0; i != rep.size() + k + 1; ++i) {
+        check(i >= k && i - k < rep.size() && rep[i - k], left.getBit(i));
+        check(i + k < rep.size() && rep[i + k], right.getBit(i));
+      }
+      check(left, _Bitset(bitset) << k);
+      check(right, _Bitset(bitset) >> k);
+      _Bitset b = bitset;
+      b <<= k;
+      check(left, b);
+      b >>= k;
+      check(bitset, b);
+      b >>= k;
+      check(right, b);
+    }
+  }
+
+  for (size_t j = 0; j != reps.size(); ++j) {
+    vector<bool> rep = reps[j];
+    _Bitset bitset = bitsets[j];
+    for (iu n = 0; n != 12; ++n) {
+      seed = seed * 1103515245 + 12345;
+      size_t begin = (seed >> 8) % (rep.size() + 200);
+      seed = seed * 1103515245 + 12345;
+      size_t end = begin + (seed >> 8) % (n % 3 == 0 ? 20 : 700);
+
+      size_t count = 0;
+      for (size_t i = begin; i < end && i < rep.size(); ++i) {
+        count += rep[i];
+      }
+      check(count, bitset.countRange(begin, end));
+      check(count != 0, bitset.anyInRange(begin, end));
+      check(count == end - begin, bitset.allInRange(begin, end));
+
+      if (rep.size() < end) {
+        rep.resize(end);
+      }
+      for (size_t i = begin; i != end; ++i) {
+        rep[i] = n % 3 == 0 ? true : n % 3 == 1 ? !rep[i] : false;
+      }
+      if (n % 3 == 0) {
+        bitset.setRange(begin, end);
+      } else if (n % 3 == 1) {
+        bitset.flipRange(begin, end);
+      } else {
+        bitset.clearRange(begin, end);
+      }
+      for (size_t i = 0; i != rep.size() + 1; ++i) {
+        check(i < rep.size() && rep[i], bitset.getBit(i));
+      }
+    }
+  }
+
+  for (size_t i : {0, 5, 31, 32, 3000, 99999}) {
+    _Bitset sparse;
+    sparse.setBit(i);
+    sparse.setBit(100000);
+    check(i, sparse.getNextSetBit(0));
+    check(100000, sparse.getNextSetBit(i + 1));
+    check(_Bitset::nonIndex, sparse.getNextSetBit(100001));
+    check(!sparse.empty());
+    sparse.clearBit(i);
+    sparse.clearBit(100000);
+    check(sparse.empty());
+    check(_Bitset(), sparse);
+
+    _Bitset dense(100001);
+    for (size_t j = 0; j != 100001; ++j) {
+      if (j != i) {
+        dense.setExistingBit(j);
+      }
+    }
+    check(i, dense.getNextClearBit(0));
+    check(100001, dense.getNextClearBit(i + 1));
+    check(i, dense.getPrevClearBit(100000));
+    check(_Bitset::nonIndex, dense.getPrevClearBit(i - 1));
+    check(i == 0 ? _Bitset::nonIndex : i - 1, dense.getPrevSetBit(i));
+
+    _Bitset pair;
+    pair.setBit(i);
+    pair.setBit(100000);
+    check(100000, pair.getHighestSetBit());
+    check(i, pair.getPrevSetBit(99999));
+    check(i, pair.getPrevSetBit(i));
+    check(_Bitset::nonIndex, pair.getPrevSetBit(i - 1));
+    pair.clearBit(100000);
+    check(i, pair.getHighestSetBit());
+  }
+  check(_Bitset::nonIndex, _Bitset().getHighestSetBit());
+}
+
+void testWideBitsets () {
+  testWideBitsets<BasicBitset<iu32>>();
+  testWideBitsets<BasicBitset<iu64>>();
+#ifdef __SIZEOF_INT128__
+  testWideBitsets<BasicBitset<bitset::iu128>>();
+#endif
+}
+
+void checkCompressedBitset (const set<size_t> &rep, const CompressedBitset &bitset) {
+  check(rep.size(), bitset.count());
+  check(rep.empty(), bitset.empty());
+  size_t i = 0;
+  for (size_t v : rep) {
+    check(v, bitset.getNextSetBit(i));
+    check(true, bitset.getBit(v));
+    if (v != 0) {
+      check(rep.count(v - 1) != 0, bitset.getBit(v - 1));
+    }
+    i = v + 1;
+  }
+  check(CompressedBitset::nonIndex, bitset.getNextSetBit(i));
+}
+
+void testCompressedBitsets () {
+  iu32 seed = 7;
+  auto random = [&seed] () -> size_t {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+  };
+
+  vector<set<size_t>> reps;
+  vector<CompressedBitset> bitsets;
+  for (iu kind = 0; kind != 6; ++kind) {
+    set<size_t> rep;
+    CompressedBitset bitset;
+    auto add = [&] (size_t i) {
+      rep.insert(i);
+      bitset.setBit(i);
+    };
+    switch (kind) {
+      case 1:
+        for (iu i = 0; i != 300; ++i) {
+          add(((random() << 16) ^ random()) & CompressedBitset::maxIndex);
+        }
+        add(0);
+        add(CompressedBitset::maxIndex);
+        break;
+      case 2:
+        for (size_t i = 70000; i != 90000; ++i) {
+          add(i);
+        }
+        break;
+      case 3:
+        for (iu i = 0; i != 10000; ++i) {
+          add(3 * 65536 + random() % 65536);
+        }
+        break;
+      case 4:
+        for (size_t i = 65530; i != 65560; ++i) {
+          add(i);
+        }
+        for (iu i = 0; i != 3000; ++i) {
+          add(random() % (65536 * 5));
+        }
+        break;
+      case 5:
+        for (iu i = 0; i != 5000; ++i) {
+          add(65536 + random() % 8000);
+        }
+        for (iu i = 0; i != 2000; ++i) {
+          size_t v = 65536 + random() % 8000;
+          rep.erase(v);
+          bitset.clearBit(v);
+        }
+        break;
+    }
+    checkCompressedBitset(rep, bitset);
+    CompressedBitset compacted = bitset;
+    compacted.compact();
+    checkCompressedBitset(rep, compacted);
+    check(bitset, compacted);
+
+    if (rep.empty() || *rep.rbegin() < 65536 * 64) {
+      Bitset plain = bitset.toBitset();
+      for (size_t v : rep) {
+        check(true, plain.getBit(v));
+      }
+      check(rep.size(), plain.count());
+      CompressedBitset converted(plain);
+      checkCompressedBitset(rep, converted);
+      check(bitset, converted);
+    }
+
+    reps.emplace_back(move(rep));
+    bitsets.emplace_back(move(bitset));
+  }
+
+  for (size_t j = 0; j != reps.size(); ++j) {
+    for (size_t k = 0; k != reps.size(); ++k) {
+      const set<size_t> &rep0 = reps[j];
+      const set<size_t> &rep1 = reps[k];
+      set<size_t> orRep;
+      set<size_t> andRep;
+      set<size_t> andNotRep;
+      set_union(rep0.begin(), rep0.end(), rep1.begin(), rep1.end(), inserter(orRep, orRep.end()));
+      set_intersection(rep0.begin(), rep0.end(), rep1.begin(), rep1.end(), inserter(andRep, andRep.end()));
+      set_difference(rep0.begin(), rep0.end(), rep1.begin(), rep1.end(), inserter(andNotRep, andNotRep.end()));
+
+      checkCompressedBitset(orRep, bitsets[j] | bitsets[k]);
+      checkCompressedBitset(andRep, bitsets[j] & bitsets[k]);
+      checkCompressedBitset(andNotRep, CompressedBitset::andNot(bitsets[j], bitsets[k]));
+      CompressedBitset b = bitsets[j];
+      b |= bitsets[k];
+      b.andNot(bitsets[j]);
+      b &= bitsets[k];
+      set<size_t> reverseAndNotRep;
+      set_difference(rep1.begin(), rep1.end(), rep0.begin(), rep0.end(), inserter(reverseAndNotRep, reverseAndNotRep.end()));
+      checkCompressedBitset(reverseAndNotRep, b);
+      check(j == k, bitsets[j] == bitsets[k]);
+    }
+  }
+
+  // Drain a run and a bitmap chunk bit by bit.
+  for (size_t kind : {2, 3}) {
+    set<size_t> rep = reps[kind];
+    CompressedBitset bitset = bitsets[kind];
+    bitset.compact();
+    iu n = 0;
+    while (!rep.empty()) {
+      size_t v = *rep.begin();
+      if (rep.size() > 1 && n % 2 == 0) {
+        v = *next(rep.begin(), static_cast<ptrdiff_t>(rep.size() / 2));
+      }
+      rep.erase(v);
+      bitset.clearBit(v);
+      if (++n % 1000 == 0) {
+        checkCompressedBitset(rep, bitset);
+      }
+    }
+    check(bitset.empty());
+    check(CompressedBitset(), bitset);
+  }
+}
+
+constexpr FixedBitset<Rep::valueSize> createFixedBitset (size_t i0, size_t i1) {
+  FixedBitset<Rep::valueSize> bitset;
+  bitset.setBit(i0);
+  bitset.setBit(i1);
+  return bitset;
+}
+
+static_assert(createFixedBitset(3, 95).getBit(95), "");
+static_assert(!createFixedBitset(3, 95).getBit(94), "");
+static_assert(createFixedBitset(3, 95).getNextSetBit(4) == 95, "");
+static_assert(createFixedBitset(3, 95).getNextSetBit(96) == FixedBitset<Rep::valueSize>::nonIndex, "");
+static_assert((createFixedBitset(3, 95) | createFixedBitset(4, 5)) != createFixedBitset(3, 95), "");
+static_assert((createFixedBitset(3, 95) & createFixedBitset(3, 5)).getNextSetBit(0) == 3, "");
+static_assert(FixedBitset<Rep::valueSize>::andNot(createFixedBitset(3, 95), createFixedBitset(3, 3)) != createFixedBitset(3, 95), "");
+static_assert(FixedBitset<0>().empty(), "");
+
+void testFixedBitsets () {
+  typedef FixedBitset<Rep::valueSize> Fixed;
+
+  vector<Rep> reps = createBitsets(0, 3);
+  vector<Fixed> bitsets;
+  for (Rep &rep : reps) {
+    Fixed bitset;
+    check(bitset.empty());
+    for (iu i = 0; i != Rep::valueSize; ++i) {
+      if (rep.value[i]) {
+        bitset.setBit(i);
+      }
+    }
+    check(rep.empty(), bitset.empty());
+    for (iu i = 0; i != Rep::valueSize; ++i) {
+      check(rep.value[i], bitset.getBit(i));
+    }
+    bitsets.emplace_back(bitset);
+  }
+
+  for (size_t j = 0; j != reps.size(); ++j) {
+    const Fixed &bitset0 = bitsets[j];
+    Bitset plain0 = bitset0.toBitset();
+    check(bitset0, Fixed(plain0));
+    for (iu i = 0; i != Rep::valueSize + 1; ++i) {
+      check(plain0.getNextSetBit(i), bitset0.getNextSetBit(i));
+    }
+
+    for (size_t k = 0; k < reps.size(); k += 7) {
+      const Fixed &bitset1 = bitsets[k];
+      Bitset plain1 = bitset1.toBitset();
+
+      check(plain0 | plain1, (bitset0 | bitset1).toBitset());
+      check(plain0 & plain1, (bitset0 & bitset1).toBitset());
+      check(Bitset::andNot(plain0, plain1), Fixed::andNot(bitset0, bitset1).toBitset());
+      Fixed b = bitset0;
+      b |= bitset1;
+      check(bitset0 | bitset1, b);
+      b &= bitset1;
+      check(bitset1, b);
+      b.andNot(bitset0);
+      check(Fixed::andNot(bitset1, bitset0), b);
+      check(plain0 == plain1, bitset0 == bitset1);
+    }
+  }
+
+  Bitset wide;
+  wide.setBit(5);
+  wide.setBit(Rep::valueSize - 1);
+  wide.setBit(Rep::valueSize);
+  wide.setBit(1000);
+  Fixed truncated(wide);
+  check(Rep::valueSize - 1, truncated.getNextSetBit(6));
+  check(Fixed::nonIndex, truncated.getNextSetBit(Rep::valueSize));
+  check(Fixed(), Fixed(Bitset()));
+  FixedBitset<3> narrow(wide);
+  check(FixedBitset<3>::nonIndex, narrow.getNextSetBit(0));
+}
+
+void testConcurrentBitsets () {
+  {
+    ConcurrentBitset bitset;
+    set<size_t> rep;
+    check(ConcurrentBitset::nonIndex, bitset.getNextSetBit(0));
+    check(0, bitset.getNextClearBit(0));
+    check(Bitset(), bitset.toBitset());
+    for (size_t i : {5, 63, 64, 4095, 4096, 12287, 12288, 1000000, 70000}) {
+      check(false, bitset.testAndSet(i));
+      check(true, bitset.testAndSet(i));
+      rep.insert(i);
+    }
+    bitset.setBit(6);
+    rep.insert(6);
+    bitset.clearBit(63);
+    rep.erase(63);
+    check(true, bitset.testAndClear(64));
+    check(false, bitset.testAndClear(64));
+    rep.erase(64);
+    bitset.clearBit(99999999);
+    check(false, bitset.testAndClear(99999999));
+
+    Bitset expected;
+    for (size_t i = 0; i != 1000002; ++i) {
+      check(rep.count(i) != 0, bitset.getBit(i));
+      if (rep.count(i) != 0) {
+        expected.setBit(i);
+      }
+    }
+    check(expected, bitset.toBitset());
+    for (size_t i : {0, 5, 6, 7, 4095, 4097, 12288, 12289, 70000, 500000, 1000000, 1000001, 99999999}) {
+      check(expected.getNextSetBit(i), bitset.getNextSetBit(i));
+      check(expected.getNextClearBit(i), bitset.getNextClearBit(i));
+    }
+
+    ConcurrentBitset full(1000);
+    for (size_t i = 0; i != 1000; ++i) {
+      full.setBit(i);
+    }
+    check(1000, full.getNextClearBit(0));
+    check(ConcurrentBitset::nonIndex, full.getNextSetBit(1000));
+  }
+
+  {
+    // Have the threads claim every index exactly once, while others set bits far enough apart to force growth.
+    static const size_t width = 200000;
+    static const iu threadCount = 4;
+    ConcurrentBitset claimed;
+    ConcurrentBitset spread;
+    vector<size_t> claimCounts(threadCount, 0);
+    vector<thread> threads;
+    for (iu t = 0; t != threadCount; ++t) {
+      threads.emplace_back([&, t] () {
+        for (size_t i = 0; i != width; ++i) {
+          if (!claimed.testAndSet(i)) {
+            ++claimCounts[t];
+          }
+          if (i % threadCount == t) {
+            spread.setBit(i * 97);
+          }
+        }
+      });
+    }
+    for (thread &thread : threads) {
+      thread.join();
+    }
+
+    size_t claimCount = 0;
+    for (size_t count : claimCounts) {
+      claimCount += count;
+    }
+    check(width, claimCount);
+    check(width, claimed.getNextClearBit(0));
+    size_t i = spread.getNextSetBit(0);
+    for (size_t j = 0; j != width; ++j) {
+      check(j * 97, i);
+      i = spread.getNextSetBit(i + 1);
+    }
+    check(ConcurrentBitset::nonIndex, i);
+  }
+}
+
+void testBitsetViews () {
+  typedef Bitset::word word;
+  static const size_t bits = sizeof(word) * CHAR_BIT;
+
+  {
+    BitsetView view;
+    check(true, view.empty());
+    check(0, view.count());
+    check(false, view.getBit(0));
+    check(BitsetView::nonIndex, view.getNextSetBit(0));
+    check(0, view.getNextClearBit(0));
+    check(Bitset(), view.toBitset());
+    check(true, view == Bitset());
+    check(true, Bitset() == view);
+  }
+
+  // Words held outside of any Bitset, as they would be in a mapped file.
+  vector<word> words(40, 0);
+  words[0] = 0b1011;
+  words[3] = ~static_cast<word>(0);
+  words[39] = static_cast<word>(1) << (bits - 1);
+  BitsetView view(words.data(), words.size());
+  Bitset expected;
+  for (size_t i : {0, 1, 3}) {
+    expected.setBit(i);
+  }
+  for (size_t i = 3 * bits; i != 4 * bits; ++i) {
+    expected.setBit(i);
+  }
+  expected.setBit(40 * bits - 1);
+
+  check(40, view.getWordCount());
+  check(words.data(), view.getWords());
+  check(false, view.empty());
+  check(expected.count(), view.count());
+  check(expected, view.toBitset());
+  check(true, view == expected);
+  check(false, view != expected);
+  for (size_t i : {size_t(0), size_t(1), size_t(2), size_t(4), 3 * bits - 1, 3 * bits, 4 * bits, 40 * bits - 2, 40 * bits - 1, 40 * bits, size_t(99999)}) {
+    check(expected.getBit(i), view.getBit(i));
+    check(expected.getNextSetBit(i), view.getNextSetBit(i));
+    check(expected.getNextClearBit(i), view.getNextClearBit(i));
+  }
+
+  // Trailing zero words do not affect equality.
+  vector<word> padded(words);
+  padded.resize(60, 0);
+  check(true, BitsetView(padded.data(), padded.size()) == view);
+  padded[59] = 1;
+  check(false, BitsetView(padded.data(), padded.size()) == view);
+
+  Bitset other;
+  for (size_t i : {size_t(1), size_t(2), 3 * bits + 5, 70 * bits}) {
+    other.setBit(i);
+  }
+  BitsetView otherView(other);
+  check(expected | other, view | otherView);
+  check(expected | other, other | view);
+  check(expected & other, view & other);
+  check(expected & other, otherView & view);
+  check(Bitset::andNot(expected, other), BitsetView::andNot(view, other));
+  check(Bitset::andNot(other, expected), BitsetView::andNot(otherView, view));
+  check(expected, view | BitsetView());
+  check(Bitset(), view & BitsetView());
+}
+
+void testSerialization () {
+  typedef Bitset::word word;
+
+  Bitset bitset;
+  for (size_t i = 0; i < 100000; i += 7) {
+    bitset.setBit(i);
+  }
+  bitset.setBit(200000);
+  bitset.ensureWidth(300000);
+
+  for (bool trim : {false, true}) {
+    for (bool checksummed : {false, true}) {
+      stringstream out;
+      check(true, BitsetWriter::write(out, bitset, trim, checksummed));
+      string data = out.str();
+      size_t unitCount = ((trim ? 200001 : 300000) + 63) / 64;
+      check(BitsetFormat::headerSize + (unitCount + (checksummed ? 1 : 0)) * BitsetFormat::unitSize, data.size());
+      // The header is little-endian whatever the host.
+      check('B', data[0]);
+      check('S', data[1]);
+      check(1, data[4]);
+      check(0, data[5]);
+
+      stringstream in(data);
+      Bitset read;
+      check(true, BitsetReader::read(in, read));
+      check(bitset, read);
+
+      // Use the bytes in place, as a mapped file would be.
+      vector<iu64> mapped((data.size() + 7) / 8);
+      memcpy(mapped.data(), data.data(), data.size());
+      BitsetView view;
+      check(true, BitsetFormat::view(mapped.data(), data.size(), view));
+      check(bitset, view);
+      check(false, BitsetFormat::view(mapped.data(), data.size() - 8, view));
+
+      if (checksummed) {
+        string corrupt(data);
+        corrupt[BitsetFormat::headerSize + 100] ^= 0b100;
+        stringstream corruptIn(corrupt);
+        check(false, BitsetReader::read(corruptIn, read));
+      }
+      stringstream truncated(data.substr(0, data.size() - 9));
+      check(false, BitsetReader::read(truncated, read));
+    }
+  }
+
+  {
+    stringstream out;
+    check(true, BitsetWriter::write(out, Bitset()));
+    stringstream in(out.str());
+    Bitset read(100);
+    read.setBit(5);
+    check(true, BitsetReader::read(in, read));
+    check(Bitset(), read);
+
+    string bad(out.str());
+    bad[3] = 'X';
+    stringstream badIn(bad);
+    check(false, BitsetReader::read(badIn, read));
+    string future(out.str());
+    future[4] = 2;
+    stringstream futureIn(future);
+    check(false, BitsetReader::read(futureIn, read));
+  }
+
+  {
+    // Stream the words in and out in uneven pieces.
+    vector<word> words(5000);
+    for (size_t i = 0; i != words.size(); ++i) {
+      words[i] = static_cast<word>(i * 0x9E3779B97F4A7C15);
+    }
+    stringstream out;
+    BitsetWriter writer(out, words.size() + 3);
+    for (size_t i = 0; i != words.size(); ) {
+      size_t n = std::min(words.size() - i, i % 1000 + 1);
+      writer.write(words.data() + i, n);
+      i += n;
+    }
+    check(true, writer.finish());
+
+    stringstream in(out.str());
+    BitsetReader reader(in);
+    check(true, reader.open());
+    check(true, reader.getWordCount() >= words.size() + 3);
+    vector<word> read(words.size(), 0);
+    for (size_t i = 0; i != read.size(); ) {
+      size_t n = std::min(read.size() - i, i % 777 + 1);
+      check(true, reader.read(read.data() + i, n));
+      i += n;
+    }
+    check(true, reader.finish());
+    check(true, words == read);
+  }
+}
+
+void testBitsetStreams () {
+  typedef Bitset::word word;
+
+  auto serialize = [] (const Bitset &bitset) -> string {
+    stringstream out;
+    check(true, BitsetWriter::write(out, bitset));
+    return out.str();
+  };
+  auto deserialize = [] (const string &data) -> Bitset {
+    stringstream in(data);
+    Bitset bitset;
+    check(true, BitsetReader::read(in, bitset));
+    return bitset;
+  };
+
+  Bitset small;
+  for (size_t i = 0; i < 3000; i += 3) {
+    small.setBit(i);
+  }
+  Bitset big;
+  for (size_t i = 0; i < 500000; i += 5) {
+    big.setBit(i);
+  }
+  big.setBit(999999);
+  vector<Bitset> bitsets = {Bitset(), small, big};
+
+  for (size_t chunkSize : {sizeof(word), size_t(72), size_t(4096), BitsetStream::defaultChunkSize}) {
+    for (const Bitset &l : bitsets) {
+      for (const Bitset &r : bitsets) {
+        string lData = serialize(l);
+        string rData = serialize(r);
+        {
+          stringstream lIn(lData), rIn(rData), out;
+          check(true, BitsetStream::orOp(lIn, rIn, out, true, chunkSize));
+          check(l | r, deserialize(out.str()));
+        }
+        {
+          stringstream lIn(lData), rIn(rData), out;
+          check(true, BitsetStream::andOp(lIn, rIn, out, false, chunkSize));
+          check(l & r, deserialize(out.str()));
+        }
+        {
+          stringstream lIn(lData), rIn(rData), out;
+          check(true, BitsetStream::andNot(lIn, rIn, out, true, chunkSize));
+          check(Bitset::andNot(l, r), deserialize(out.str()));
+        }
+        {
+          stringstream lIn(lData), rIn(rData);
+          vector<word> words;
+          check(true, BitsetStream::orOp(lIn, rIn, [&] (const word *b, size_t size) {
+            words.insert(words.end(), b, b + size);
+          }, chunkSize));
+          check(l | r, BitsetView(words.data(), words.size()));
+        }
+        size_t count = 0;
+        {
+          stringstream lIn(lData), rIn(rData);
+          check(true, BitsetStream::orCount(lIn, rIn, count, chunkSize));
+          check(Bitset::orCount(l, r), count);
+        }
+        {
+          stringstream lIn(lData), rIn(rData);
+          check(true, BitsetStream::andCount(lIn, rIn, count, chunkSize));
+          check(Bitset::andCount(l, r), count);
+        }
+        {
+          stringstream lIn(lData), rIn(rData);
+          check(true, BitsetStream::andNotCount(lIn, rIn, count, chunkSize));
+          check(Bitset::andNotCount(l, r), count);
+        }
+      }
+    }
+  }
+
+  {
+    string bigData = serialize(big);
+    string smallData = serialize(small);
+    size_t count = 0;
+    stringstream truncated(bigData.substr(0, bigData.size() / 2)), smallIn(smallData);
+    check(false, BitsetStream::orCount(smallIn, truncated, count, 4096));
+
+    string corrupt(bigData);
+    corrupt[corrupt.size() - 20] ^= 0b1;
+    stringstream corruptIn(corrupt), smallIn2(smallData);
+    check(false, BitsetStream::andNotCount(corruptIn, smallIn2, count, 4096));
+
+    // Only the words that overlap are needed for &, so the rest of big (and its checksum) goes unread.
+    stringstream corruptIn2(corrupt), smallIn3(smallData);
+    check(true, BitsetStream::andCount(corruptIn2, smallIn3, count, 4096));
+    check(Bitset::andCount(big, small), count);
+  }
+}
+
+void testAllocators () {
+  /**
+    Passes allocations through to a pool, counting them.
+  */
+  class CountingAllocator : public WordAllocator {
+    pub PoolAllocator pool;
+    pub size_t allocationCount = 0;
+    pub size_t liveCount = 0;
+
+    pub void *allocate (size_t size) override {
+      ++allocationCount;
+      ++liveCount;
+      return pool.allocate(size);
+    }
+
+    pub void deallocate (void *p, size_t size) noexcept override {
+      --liveCount;
+      pool.deallocate(p, size);
+    }
+  };
+
+  Bitset l;
+  Bitset r;
+  for (size_t i = 0; i < 5000; i += 3) {
+    l.setBit(i);
+    r.setBit(i * 2);
+  }
+  Bitset expected = (l | r) & Bitset::andNot(r, l);
+  check(nullptr, WordAllocator::getCurrent());
+
+  CountingAllocator counting;
+  Bitset kept;
+  {
+    AllocatorScope scope(counting);
+    check(&counting, WordAllocator::getCurrent());
+    Bitset result = (l | r) & Bitset::andNot(r, l);
+    check(expected, result);
+    check(&counting, result.getAllocator());
+    check(true, counting.allocationCount != 0);
+
+    // Moving into a bitset with another allocator copies, so that kept does not depend on counting.
+    kept = move(result);
+    check(nullptr, kept.getAllocator());
+    check(expected, kept);
+    Bitset moved(move(kept));
+    check(nullptr, moved.getAllocator());
+    kept = move(moved);
+
+    // Copies take the current allocator.
+    Bitset copy(l);
+    check(&counting, copy.getAllocator());
+    check(l, copy);
+    copy |= Bitset(r);
+    check(l | r, copy);
+  }
+  check(nullptr, WordAllocator::getCurrent());
+  check(0, counting.liveCount);
+  check(expected, kept);
+
+  {
+    MonotonicArena arena(64);
+    Bitset a(arena);
+    check(&arena, a.getAllocator());
+    for (iu pass = 0; pass != 3; ++pass) {
+      AllocatorScope scope(arena);
+      for (size_t i = 0; i < 100000; i += 1000) {
+        a.setBit(i);
+      }
+      Bitset b = a | l;
+      check(true, (b & l) == l);
+      b.andNot(a);
+      check(Bitset::andNot(l, a), b);
+    }
+    PoolAllocator pool;
+    {
+      AllocatorScope scope(pool);
+      AllocatorScope inner(arena);
+      check(&arena, WordAllocator::getCurrent());
+    }
+    check(nullptr, WordAllocator::getCurrent());
+  }
+
+  {
+    // Freed buffers are reused within their size class.
+    PoolAllocator pool;
+    void *p = pool.allocate(100);
+    pool.deallocate(p, 100);
+    check(p, pool.allocate(128));
+    void *big = pool.allocate(10 << 20);
+    pool.deallocate(big, 10 << 20);
+    pool.deallocate(p, 128);
+  }
+}
+
+void testSharedBitsets () {
+  Bitset a;
+  a.enableSharing();
+  for (size_t i = 0; i < 10000; i += 7) {
+    a.setBit(i);
+  }
+  Bitset original = a;
+  check(true, BitsetView(original).getWords() == BitsetView(a).getWords());
+
+  // Changing either copy gives it its own words.
+  Bitset b = a;
+  check(true, BitsetView(b).getWords() == BitsetView(a).getWords());
+  b.setBit(3);
+  check(false, BitsetView(b).getWords() == BitsetView(a).getWords());
+  check(true, b.getBit(3));
+  check(false, a.getBit(3));
+  check(original, a);
+  Bitset c = a;
+  c.clearExistingBit(7);
+  check(true, a.getBit(7));
+  check(false, c.getBit(7));
+  c = a;
+  c |= b;
+  check(b, c);
+  check(original, a);
+  c = a;
+  c.flip(20000);
+  check(20000 - a.count(), c.count());
+  check(original, a);
+
+  // Operations on shared words short-cut.
+  Bitset d = a;
+  check(a, a | d);
+  check(a, d & a);
+  check(true, BitsetView(a | d).getWords() == BitsetView(a).getWords());
+  check(true, Bitset::andNot(a, d).empty());
+  check(true, (a ^ d).empty());
+  d |= a;
+  check(a, d);
+  d &= a;
+  check(a, d);
+  d ^= a;
+  check(true, d.empty());
+  check(original, a);
+
+  // Copies are not shared without sharing, nor across allocators.
+  Bitset plain = original;
+  plain.disableSharing();
+  Bitset plainCopy = plain;
+  check(false, BitsetView(plainCopy).getWords() == BitsetView(plain).getWords());
+  {
+    PoolAllocator pool;
+    AllocatorScope scope(pool);
+    Bitset pooled = a;
+    check(false, BitsetView(pooled).getWords() == BitsetView(a).getWords());
+    check(a, pooled);
+  }
+  Bitset e = a;
+  a.disableSharing();
+  check(false, BitsetView(e).getWords() == BitsetView(a).getWords());
+  Bitset f = a;
+  check(false, BitsetView(f).getWords() == BitsetView(a).getWords());
+  check(original, f);
+  check(original, e);
+}
+
+void testTrimPolicies () {
+  Bitset high;
+  for (size_t i = 1000; i < 100000; i += 100) {
+    high.setBit(i);
+  }
+  Bitset low;
+  for (size_t i = 0; i < 1000; i += 3) {
+    low.setBit(i);
+  }
+  size_t lowWordCount = BitsetView(low).getWordCount();
+
+  // The bitset keeps track of its highest set bit through changes to single bits.
+  Bitset wide(200000);
+  check(true, wide.empty());
+  check(Bitset(), wide);
+  wide.setBit(150000);
+  check(false, wide.empty());
+  check(false, Bitset() == wide);
+  wide.setBit(7);
+  wide.clearBit(150000);
+  check(false, wide.empty());
+  Bitset seven;
+  seven.setBit(7);
+  check(seven, wide);
+  wide.clearExistingBit(7);
+  check(true, wide.empty());
+
+  // Operations drop the zero words they leave at the top, unless told to keep them.
+  Bitset both = high | low;
+  check(true, BitsetView(both & low).getWordCount() <= lowWordCount);
+  check(true, BitsetView(Bitset::andNot(both, high)).getWordCount() <= lowWordCount);
+  check(true, BitsetView(both ^ high).getWordCount() <= lowWordCount);
+  check(low, Bitset::andNot(both, high));
+  Bitset lowAndTop = low;
+  lowAndTop.setBit(99950);
+  check(true, BitsetView(BitsetView(both) & BitsetView(lowAndTop)).getWordCount() <= lowWordCount);
+  check(true, BitsetView(BitsetView::andNot(BitsetView(both), BitsetView(high))).getWordCount() <= lowWordCount);
+  check(true, BitsetView(Bitset(lazy(both) & lowAndTop)).getWordCount() <= lowWordCount);
+  check(true, BitsetView(Bitset(Bitset::andNot(lazy(both), high))).getWordCount() <= lowWordCount);
+  Bitset kept = both;
+  check(Bitset::TrimPolicy::TRIM, kept.getTrimPolicy());
+  kept.setTrimPolicy(Bitset::TrimPolicy::KEEP);
+  kept.andNot(high);
+  check(BitsetView(both).getWordCount(), BitsetView(kept).getWordCount());
+  check(low, kept);
+  kept.setTrimPolicy(Bitset::TrimPolicy::SHRINK);
+  check(true, BitsetView(kept).getWordCount() <= lowWordCount);
+  check(low, kept);
+  kept ^= low;
+  check(size_t(0), BitsetView(kept).getWordCount());
+  check(true, kept.empty());
+
+  Bitset shifted = low;
+  shifted >>= 500;
+  Bitset expected;
+  for (size_t i = 0; i < 1000; i += 3) {
+    if (i >= 500) {
+      expected.setBit(i - 500);
+    }
+  }
+  check(expected, shifted);
+  const Bitset &constLow = low;
+  Bitset constShifted = constLow >> 500;
+  check(expected, constShifted);
+  check(BitsetView(expected).getWordCount(), BitsetView(constShifted).getWordCount());
+  Bitset single;
+  single.setBit(1000);
+  const Bitset &constSingle = single;
+  check(size_t(1), BitsetView(constSingle >> 990).getWordCount());
+  check(size_t(10), (constSingle >> 990).getNextSetBit(0));
+
+  // Trimming stops at the width that was asked for, so the bits within it can still be set as existing bits.
+  size_t sizedWordCount = BitsetView(Bitset(1000)).getWordCount();
+  Bitset sized(1000);
+  sized.setExistingBit(9);
+  sized.andNot(low);
+  check(sizedWordCount, BitsetView(sized).getWordCount());
+  sized.setExistingBit(500);
+  Bitset sizedCopy = sized;
+  sized ^= sizedCopy;
+  check(true, sized.empty());
+  check(sizedWordCount, BitsetView(sized).getWordCount());
+  sized.setExistingBit(700);
+  sized >>= 1;
+  check(sizedWordCount, BitsetView(sized).getWordCount());
+  sized.setExistingBit(999);
+  check(size_t(699), sized.getNextSetBit(0));
+  check(size_t(999), sized.getNextSetBit(700));
+  Bitset grown;
+  grown.ensureWidth(1000);
+  grown.setExistingBit(5);
+  grown &= low;
+  grown.setExistingBit(999);
+  check(size_t(999), grown.getNextSetBit(6));
+
+  // A bitset that has been moved from is empty.
+  Bitset moved = both;
+  Bitset taken(move(moved));
+  check(true, moved.empty());
+  check(Bitset(), moved);
+  check(both, taken);
+  moved = move(taken);
+  check(true, taken.empty());
+  check(both, moved);
+}
+
+void testHashingAndOrdering () {
+  // Bitsets that are equal hash equally, whatever zero words they have at the top.
+  Bitset wide(100000);
+  wide.setBit(5);
+  wide.setBit(700);
+  Bitset narrow;
+  narrow.setBit(700);
+  narrow.setBit(5);
+  check(narrow, wide);
+  check(narrow.hash(), wide.hash());
+  check(std::hash<Bitset>()(narrow), wide.hash());
+  check(Bitset().hash(), Bitset(5000).hash());
+  check(false, Bitset().hash() == narrow.hash());
+  BasicBitset<iu32> narrow32;
+  narrow32.setBit(5);
+  BasicBitset<iu32> wide32(3000);
+  wide32.setBit(5);
+  check(narrow32.hash(), wide32.hash());
+
+  unordered_set<Bitset> distinct;
+  for (size_t n = 0; n != 300; ++n) {
+    Bitset b(n % 7 == 0 ? 4000 : 0);
+    for (size_t i = 0; i != 12; ++i) {
+      if ((n % 150) & (static_cast<size_t>(1) << i)) {
+        b.setBit(i * 97);
+      }
+    }
+    distinct.insert(b);
+  }
+  check(size_t(150), distinct.size());
+
+  // The cached hash follows changes.
+  Bitset cached = narrow;
+  cached.enableHashCache();
+  size_t h = cached.hash();
+  check(narrow.hash(), h);
+  check(h, cached.hash());
+  cached.setBit(100000);
+  Bitset plain = narrow;
+  plain.setBit(100000);
+  check(plain.hash(), cached.hash());
+  cached.clearBit(100000);
+  check(h, cached.hash());
+  cached |= Bitset(wide) <<= 1;
+  check((narrow | (wide << 1)).hash(), cached.hash());
+  Bitset copy = cached;
+  check(cached.hash(), copy.hash());
+  copy.andNot(wide << 1);
+  check(h, copy.hash());
+  cached.disableHashCache();
+  check(copy.hash() != cached.hash(), copy != cached);
+
+  // Bitsets are ordered as the numbers that they represent.
+  vector<Bitset> numbers;
+  for (iu64 v = 0; v != 300; ++v) {
+    Bitset b(v % 5 == 0 ? 1000 : 0);
+    for (size_t i = 0; i != 64; ++i) {
+      if ((v >> i) & 0b1) {
+        b.setBit(i);
+      }
+    }
+    numbers.push_back(b);
+  }
+  for (size_t l = 0; l < numbers.size(); l += 7) {
+    for (size_t r = 0; r < numbers.size(); r += 3) {
+      check(l < r ? -1 : l == r ? 0 : 1, Bitset::compare(numbers[l], numbers[r]));
+      check(l < r, numbers[l] < numbers[r]);
+      check(l <= r, numbers[l] <= numbers[r]);
+      check(l > r, numbers[l] > numbers[r]);
+      check(l >= r, numbers[l] >= numbers[r]);
+    }
+  }
+  Bitset high;
+  high.setBit(5000);
+  check(true, numbers.back() < high);
+  set<Bitset> sorted(numbers.rbegin(), numbers.rend());
+  check(numbers, vector<Bitset>(sorted.begin(), sorted.end()));
 }
 
 /* -----------------------------------------------------------------------------